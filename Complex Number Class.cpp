@@ -1,6 +1,6 @@
-#include <cmath>
+#pragma once
 
-using namespace std;
+#include <cmath>
 
 class Complex {
 public:
@@ -69,6 +69,6 @@ public:
 private:
     double re_, im_;
 };
-double abs(const Complex& rhs) {
-    return sqrt((rhs.Im() * rhs.Im()) + (rhs.Re() * rhs.Re()));
+inline double abs(const Complex& rhs) {
+    return std::sqrt((rhs.Im() * rhs.Im()) + (rhs.Re() * rhs.Re()));
 }
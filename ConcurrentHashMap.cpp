@@ -0,0 +1,212 @@
+#pragma once
+
+#include "HashMap.cpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// HashMap split into independently locked shards. Readers of a shard share
+// its lock and writers take it exclusively, so threads only contend when
+// they touch the same shard. Values are handed out by copy or through
+// callbacks run under the shard lock, never as iterators.
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>>
+class ConcurrentHashMap {
+public:
+    using value_type = std::pair<const KeyType, ValueType>;
+
+private:
+    using Map = HashMap<KeyType, ValueType, Hash>;
+
+    // Each shard sits on its own cache line so neighbouring locks don't false-share.
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        Map map;
+    };
+
+    std::unique_ptr<Shard[]> _shards;
+    size_t _shard_count;
+    int _shard_shift;
+    Hash _hasher;
+
+    static size_t default_shards() {
+        size_t n = 4 * std::max(1u, std::thread::hardware_concurrency());
+        size_t count = 1;
+        while (count < n) {
+            count *= 2;
+        }
+        return count;
+    }
+
+    // Every key is hashed once: the mixed hash picks the shard and is then
+    // handed to the shard's *_hashed calls, which mix exactly the same way.
+    uint64_t hash_of(const KeyType &key) const {
+        return Map::mix(_hasher(key));
+    }
+
+    // The shard comes from the top bits of the hash. A shard's table takes
+    // its tag from the low 7 bits and its group index from the bits just
+    // above, so the two never overlap short of a table of 2^50 buckets.
+    Shard &shard_for(uint64_t h) const {
+        return _shards[_shard_shift == 64 ? 0 : static_cast<size_t>(h >> _shard_shift)];
+    }
+
+public:
+    explicit ConcurrentHashMap(size_t shard_count = default_shards(), Hash h = Hash()) :
+            _shard_count(1), _shard_shift(64), _hasher(h) {
+        while (_shard_count < shard_count) {
+            _shard_count *= 2;
+            --_shard_shift;
+        }
+        _shards.reset(new Shard[_shard_count]);
+        for (size_t i = 0; i < _shard_count; ++i) {
+            _shards[i].map = Map(h);
+        }
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+
+    ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
+
+    Hash hash_function() const {
+        return _hasher;
+    }
+
+    size_t shard_count() const {
+        return _shard_count;
+    }
+
+    bool insert(const value_type &p) {
+        uint64_t h = hash_of(p.first);
+        Shard &shard = shard_for(h);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.emplace_hashed(h, p.first, p.second).second;
+    }
+
+    template<class... Args>
+    bool try_emplace(const KeyType &key, Args &&... args) {
+        uint64_t h = hash_of(key);
+        Shard &shard = shard_for(h);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.emplace_hashed(h, key, std::forward<Args>(args)...).second;
+    }
+
+    template<class M>
+    bool insert_or_assign(const KeyType &key, M &&obj) {
+        uint64_t h = hash_of(key);
+        Shard &shard = shard_for(h);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.assign_hashed(h, key, std::forward<M>(obj)).second;
+    }
+
+    size_t erase(const KeyType &key) {
+        uint64_t h = hash_of(key);
+        Shard &shard = shard_for(h);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.erase_hashed(key, h);
+    }
+
+    // Copies the value into out; returns false when the key is absent.
+    bool find(const KeyType &key, ValueType &out) const {
+        uint64_t h = hash_of(key);
+        Shard &shard = shard_for(h);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.map.find_hashed(key, h);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        out = it->second;
+        return true;
+    }
+
+    bool contains(const KeyType &key) const {
+        uint64_t h = hash_of(key);
+        Shard &shard = shard_for(h);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.map.find_hashed(key, h) != shard.map.end();
+    }
+
+    // Runs f on the value under the shard's writer lock; f must not call back into the map.
+    template<class F>
+    bool visit(const KeyType &key, F f) {
+        uint64_t h = hash_of(key);
+        Shard &shard = shard_for(h);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.map.find_hashed(key, h);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        f(it->second);
+        return true;
+    }
+
+    template<class F>
+    bool visit(const KeyType &key, F f) const {
+        uint64_t h = hash_of(key);
+        Shard &shard = shard_for(h);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.map.find_hashed(key, h);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        f(static_cast<const ValueType &>(it->second));
+        return true;
+    }
+
+    // Holds every shard's reader lock at once, so the count is a true snapshot.
+    // Locks are always taken in shard order, which keeps this deadlock-free.
+    size_t size() const {
+        std::vector<std::shared_lock<std::shared_mutex>> locks;
+        locks.reserve(_shard_count);
+        size_t total = 0;
+        for (size_t i = 0; i < _shard_count; ++i) {
+            locks.emplace_back(_shards[i].mutex);
+            total += _shards[i].map.size();
+        }
+        return total;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void clear() {
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        locks.reserve(_shard_count);
+        for (size_t i = 0; i < _shard_count; ++i) {
+            locks.emplace_back(_shards[i].mutex);
+        }
+        for (size_t i = 0; i < _shard_count; ++i) {
+            _shards[i].map.clear();
+        }
+    }
+
+    // Walks the shards one at a time, each under its reader lock. Entries in
+    // a shard are seen consistently; other shards may change in between.
+    template<class F>
+    void for_each(F f) const {
+        for (size_t i = 0; i < _shard_count; ++i) {
+            std::shared_lock<std::shared_mutex> lock(_shards[i].mutex);
+            for (const auto &entry : _shards[i].map) {
+                f(entry);
+            }
+        }
+    }
+
+    // Same walk under writer locks, letting f modify the values.
+    template<class F>
+    void for_each(F f) {
+        for (size_t i = 0; i < _shard_count; ++i) {
+            std::unique_lock<std::shared_mutex> lock(_shards[i].mutex);
+            for (auto &entry : _shards[i].map) {
+                f(entry);
+            }
+        }
+    }
+};
@@ -1,71 +1,1179 @@
-#include <list>
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <ostream>
 #include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
 #include <utility>
-#include <vector>
 #include <algorithm>
+#include <atomic>
+#include <new>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#ifdef HASHMAP_STATS
+#include <chrono>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASHMAP_SSE2
+#endif
+
+// Set bits of a group match; each bit (or byte, for the portable group) is one slot.
+template<class T, int Shift>
+class BitMask {
+public:
+    explicit BitMask(T mask) : _mask(mask) {
+    }
+
+    explicit operator bool() const {
+        return _mask != 0;
+    }
+
+    size_t lowest() const {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<size_t>(__builtin_ctzll(_mask)) >> Shift;
+#else
+        size_t i = 0;
+        for (T m = _mask; (m & 1) == 0; m >>= 1) {
+            ++i;
+        }
+        return i >> Shift;
+#endif
+    }
+
+    void clear_lowest() {
+        _mask &= _mask - 1;
+    }
+
+private:
+    T _mask;
+};
+
+// A group of control bytes probed together. Free slots have the top bit set,
+// occupied ones hold the low 7 bits of the entry's hash.
+class ControlGroup {
+public:
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;
+    static constexpr int8_t SENTINEL = -1;
+
+#if defined(__AVX2__)
+    static constexpr size_t WIDTH = 32;
+
+    explicit ControlGroup(const int8_t *ctrl) :
+            _ctrl(_mm256_load_si256(reinterpret_cast<const __m256i *>(ctrl))) {
+    }
+
+    BitMask<uint32_t, 0> match(int8_t tag) const {
+        return BitMask<uint32_t, 0>(static_cast<uint32_t>(
+                _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(tag), _ctrl))));
+    }
+
+    BitMask<uint32_t, 0> match_empty() const {
+        return match(EMPTY);
+    }
+
+    BitMask<uint32_t, 0> match_free() const {
+        return BitMask<uint32_t, 0>(static_cast<uint32_t>(
+                _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(SENTINEL), _ctrl))));
+    }
+
+private:
+    __m256i _ctrl;
+#elif defined(HASHMAP_SSE2)
+    static constexpr size_t WIDTH = 16;
+
+    explicit ControlGroup(const int8_t *ctrl) :
+            _ctrl(_mm_load_si128(reinterpret_cast<const __m128i *>(ctrl))) {
+    }
+
+    BitMask<uint32_t, 0> match(int8_t tag) const {
+        return BitMask<uint32_t, 0>(static_cast<uint32_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), _ctrl))));
+    }
+
+    BitMask<uint32_t, 0> match_empty() const {
+        return match(EMPTY);
+    }
+
+    BitMask<uint32_t, 0> match_free() const {
+        return BitMask<uint32_t, 0>(static_cast<uint32_t>(
+                _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(SENTINEL), _ctrl))));
+    }
+
+private:
+    __m128i _ctrl;
+#else
+    static constexpr size_t WIDTH = 8;
+
+    explicit ControlGroup(const int8_t *ctrl) {
+        std::memcpy(&_ctrl, ctrl, sizeof(_ctrl));
+    }
+
+    // May report a false positive next to a real match; callers compare keys anyway.
+    BitMask<uint64_t, 3> match(int8_t tag) const {
+        uint64_t x = _ctrl ^ (LSBS * static_cast<uint8_t>(tag));
+        return BitMask<uint64_t, 3>((x - LSBS) & ~x & MSBS);
+    }
+
+    BitMask<uint64_t, 3> match_empty() const {
+        return BitMask<uint64_t, 3>(_ctrl & ~(_ctrl << 6) & MSBS);
+    }
+
+    BitMask<uint64_t, 3> match_free() const {
+        return BitMask<uint64_t, 3>(_ctrl & ~(_ctrl << 7) & MSBS);
+    }
+
+private:
+    static constexpr uint64_t LSBS = 0x0101010101010101ULL;
+    static constexpr uint64_t MSBS = 0x8080808080808080ULL;
+    uint64_t _ctrl;
+#endif
+};
+
+// Whether HashMap stores each entry's (mixed) hash next to it. With the hash
+// cached, rehashing never calls Hash and full-hash mismatches are rejected
+// without comparing keys. Scalar keys are cheaper to rehash than to store
+// an extra 8 bytes for, so they opt out; specialize to override.
+template<class KeyType, class Hash>
+struct HashMapCacheHash : std::integral_constant<bool, !(std::is_arithmetic<KeyType>::value ||
+                                                          std::is_enum<KeyType>::value ||
+                                                          std::is_pointer<KeyType>::value)> {
+};
+
+template<class Value, bool CacheHash>
+struct HashMapSlot {
+    Value value;
+    uint64_t hash;
+};
+
+template<class Value>
+struct HashMapSlot<Value, false> {
+    Value value;
+};
+
+// Seeded wyhash-style hashing. Every default-constructed hasher draws its
+// own seed, so each map places keys differently and an attacker cannot
+// precompute colliding keys (hash flooding).
+class FastHashBase {
+public:
+    explicit FastHashBase(uint64_t seed) : _seed(seed) {
+    }
+
+    uint64_t seed() const {
+        return _seed;
+    }
+
+    // A process-wide random value advanced by a counter for every call.
+    static uint64_t random_seed() {
+        static const uint64_t base = [] {
+            std::random_device device;
+            return (static_cast<uint64_t>(device()) << 32) ^ device();
+        }();
+        static std::atomic<uint64_t> counter{0};
+        return mum(base ^ P0, ++counter ^ P1);
+    }
+
+protected:
+    static constexpr uint64_t P0 = 0x2d358dccaa6c78a5ULL;
+    static constexpr uint64_t P1 = 0x8bb84b93962eacc9ULL;
+    static constexpr uint64_t P2 = 0x4b33a62ed433d4a3ULL;
+    static constexpr uint64_t P3 = 0x4d5a2da51de1aa47ULL;
+
+    // 64x64 -> 128-bit multiply; both halves are returned through a and b.
+    static void mum128(uint64_t &a, uint64_t &b) {
+#if defined(__SIZEOF_INT128__)
+        __uint128_t r = static_cast<__uint128_t>(a) * b;
+        a = static_cast<uint64_t>(r);
+        b = static_cast<uint64_t>(r >> 64);
+#else
+        uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32);
+        uint64_t c = t < rl;
+        uint64_t lo = t + (rm1 << 32);
+        c += lo < t;
+        a = lo;
+        b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+    }
+
+    static uint64_t mum(uint64_t a, uint64_t b) {
+        mum128(a, b);
+        return a ^ b;
+    }
+
+    static uint64_t read64(const unsigned char *p) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint64_t read32(const unsigned char *p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    uint64_t hash_word(uint64_t x) const {
+        uint64_t a = x ^ P0;
+        uint64_t b = _seed ^ P1;
+        mum128(a, b);
+        return mum(a ^ P0, b ^ P1);
+    }
+
+    uint64_t hash_bytes(const void *data, size_t len) const {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        uint64_t seed = _seed ^ mum(_seed ^ P0, P1);
+        uint64_t a, b;
+        if (len <= 16) {
+            if (len >= 4) {
+                size_t mid = (len >> 3) << 2;
+                a = (read32(p) << 32) | read32(p + mid);
+                b = (read32(p + len - 4) << 32) | read32(p + len - 4 - mid);
+            } else if (len > 0) {
+                a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+                b = 0;
+            } else {
+                a = b = 0;
+            }
+        } else {
+            size_t i = len;
+            if (i > 48) {
+                uint64_t see1 = seed, see2 = seed;
+                do {
+                    seed = mum(read64(p) ^ P1, read64(p + 8) ^ seed);
+                    see1 = mum(read64(p + 16) ^ P2, read64(p + 24) ^ see1);
+                    see2 = mum(read64(p + 32) ^ P3, read64(p + 40) ^ see2);
+                    p += 48;
+                    i -= 48;
+                } while (i > 48);
+                seed ^= see1 ^ see2;
+            }
+            while (i > 16) {
+                seed = mum(read64(p) ^ P1, read64(p + 8) ^ seed);
+                p += 16;
+                i -= 16;
+            }
+            a = read64(p + i - 16);
+            b = read64(p + i - 8);
+        }
+        a ^= P1;
+        b ^= seed;
+        mum128(a, b);
+        return mum(a ^ P0 ^ len, b ^ P1);
+    }
+
+    uint64_t _seed;
+};
+
+template<class T, class = void>
+struct FastHash;
+
+template<class T>
+struct FastHash<T, std::enable_if_t<std::is_integral<T>::value || std::is_enum<T>::value ||
+                                    std::is_pointer<T>::value>> : FastHashBase {
+    explicit FastHash(uint64_t seed = random_seed()) : FastHashBase(seed) {
+    }
+
+    size_t operator()(T key) const {
+        uint64_t x;
+        if constexpr (std::is_pointer<T>::value) {
+            x = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(key));
+        } else {
+            x = static_cast<uint64_t>(key);
+        }
+        return static_cast<size_t>(hash_word(x));
+    }
+};
+
+template<>
+struct FastHash<std::string_view> : FastHashBase {
+    explicit FastHash(uint64_t seed = random_seed()) : FastHashBase(seed) {
+    }
+
+    size_t operator()(std::string_view key) const {
+        return static_cast<size_t>(hash_bytes(key.data(), key.size()));
+    }
+};
+
+template<>
+struct FastHash<std::string> : FastHash<std::string_view> {
+    using FastHash<std::string_view>::FastHash;
+};
+
+// Snapshot returned by HashMap::stats(). The rehash and allocation counters
+// are only maintained when HASHMAP_STATS is defined and read zero otherwise;
+// everything else is computed on demand.
+struct HashMapStats {
+    size_t size = 0;
+    size_t buckets = 0;
+    size_t tombstones = 0;
+    double load_factor = 0;
+    // probe_histogram[i] counts entries found i groups past their home
+    // group; the last bucket also collects every longer probe.
+    std::vector<size_t> probe_histogram;
+    size_t bytes_in_use = 0;
+    bool incremental_rehash_pending = false;
+    size_t rehashes = 0;
+    double rehash_seconds = 0;
+    size_t bytes_allocated = 0;
+};
+
+// Leading block of a file written by HashMap::save(). The control bytes and
+// the slot array follow at the recorded offsets, both 64-byte aligned, so a
+// mapping of the file can be probed in place (see MappedHashMap).
+struct HashMapSnapshotHeader {
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t ORDER_MARK = 0x01020304;
+
+    char magic[8] = {'H', 'M', 'A', 'P', 'S', 'N', 'A', 'P'};
+    uint32_t version = VERSION;
+    uint32_t byte_order = ORDER_MARK;
+    uint32_t group_width = ControlGroup::WIDTH;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+    uint32_t slot_size = 0;
+    uint64_t buckets = 0;
+    uint64_t size = 0;
+    uint64_t ctrl_offset = 0;
+    uint64_t slots_offset = 0;
+    uint64_t file_size = 0;
+    // Bytes of the saver's Hash object when it is trivially copyable, else 0.
+    uint32_t hasher_size = 0;
+    unsigned char hasher[52] = {};
+};
 
-template<class KeyType, class ValueType, class Hash = std::hash<KeyType>>
+template<class KeyType, class ValueType, class Hash>
+class MappedHashMap;
+
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>,
+        class Alloc = std::allocator<std::pair<const KeyType, ValueType>>>
 class HashMap {
 public:
-    using const_iterator = typename std::list<std::pair<const KeyType, ValueType>>::const_iterator;
-    using iterator = typename std::list<std::pair<const KeyType, ValueType>>::iterator;
+    using value_type = std::pair<const KeyType, ValueType>;
+    using allocator_type = Alloc;
+
+private:
+    // SENTINEL terminates the control array so iterators know where to stop.
+    static constexpr int8_t EMPTY = ControlGroup::EMPTY;
+    static constexpr int8_t DELETED = ControlGroup::DELETED;
+    static constexpr int8_t SENTINEL = ControlGroup::SENTINEL;
+
+    static constexpr bool CACHE_HASH = HashMapCacheHash<KeyType, Hash>::value;
+    using Slot = HashMapSlot<value_type, CACHE_HASH>;
+
+public:
+    // Walks the current table and then, while a rehash is in progress, the old one.
+    template<bool Const>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const KeyType, ValueType>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+        using reference = std::conditional_t<Const, const value_type &, value_type &>;
+        using slot_pointer = std::conditional_t<Const, const Slot *, Slot *>;
+
+        Iterator() = default;
+
+        template<bool C = Const, class = std::enable_if_t<C>>
+        Iterator(const Iterator<false> &other) : _ctrl(other._ctrl), _slot(other._slot),
+                                                 _next_ctrl(other._next_ctrl),
+                                                 _next_slot(other._next_slot) {
+        }
+
+        reference operator*() const {
+            return _slot->value;
+        }
+
+        pointer operator->() const {
+            return &_slot->value;
+        }
+
+        Iterator &operator++() {
+            ++_ctrl;
+            ++_slot;
+            skip_free();
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        friend bool operator==(const Iterator &lhs, const Iterator &rhs) {
+            return lhs._ctrl == rhs._ctrl;
+        }
+
+        friend bool operator!=(const Iterator &lhs, const Iterator &rhs) {
+            return lhs._ctrl != rhs._ctrl;
+        }
+
+    private:
+        friend class HashMap;
+        template<bool> friend class Iterator;
+
+        Iterator(const int8_t *ctrl, slot_pointer slot, const int8_t *next_ctrl, slot_pointer next_slot) :
+                _ctrl(ctrl), _slot(slot), _next_ctrl(next_ctrl), _next_slot(next_slot) {
+        }
+
+        void skip_free() {
+            while (true) {
+                while (*_ctrl < 0 && *_ctrl != SENTINEL) {
+                    ++_ctrl;
+                    ++_slot;
+                }
+                if (*_ctrl != SENTINEL || _next_ctrl == nullptr) {
+                    return;
+                }
+                _ctrl = _next_ctrl;
+                _slot = _next_slot;
+                _next_ctrl = nullptr;
+                _next_slot = nullptr;
+            }
+        }
+
+        const int8_t *_ctrl = nullptr;
+        slot_pointer _slot = nullptr;
+        const int8_t *_next_ctrl = nullptr;
+        slot_pointer _next_slot = nullptr;
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
 
 private:
-    static constexpr int START = 4;
-    std::list<std::pair<const KeyType, ValueType>> _data;
+    static constexpr size_t START = ControlGroup::WIDTH;
+    // Old-table slots moved per insert or erase while an incremental rehash is running.
+    static constexpr size_t MIGRATE_STEP = 2 * ControlGroup::WIDTH;
+    // Keys hashed and prefetched ahead of resolution by the batched calls.
+    static constexpr size_t BATCH = 32;
+
+    // Control bytes are handed out in group-sized, group-aligned blocks.
+    struct alignas(ControlGroup::WIDTH) CtrlBlock {
+        int8_t bytes[ControlGroup::WIDTH];
+    };
+    using SlotAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Slot>;
+    using CtrlAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<CtrlBlock>;
+
+    int8_t *_ctrl = empty_ctrl();
+    Slot *_slots = nullptr;
     Hash _hasher;
-    std::vector<iterator> iters{};
-    std::vector<size_t> sz;
+    Alloc _alloc;
     size_t buckets = 0;
     size_t act_size = 0;
+    size_t _deleted = 0;
+
+    // Table being drained by an incremental rehash; slots below _migrated are already moved.
+    int8_t *_old_ctrl = nullptr;
+    Slot *_old_slots = nullptr;
+    size_t _old_buckets = 0;
+    size_t _old_size = 0;
+    size_t _migrated = 0;
+    bool _incremental = false;
+
+#ifdef HASHMAP_STATS
+    size_t _rehashes = 0;
+    std::chrono::steady_clock::duration _rehash_time{};
+    size_t _bytes_allocated = 0;
+
+    // Adds the lifetime of a rehash step to _rehash_time.
+    class RehashTimer {
+    public:
+        explicit RehashTimer(HashMap &map) : _map(map), _start(std::chrono::steady_clock::now()) {
+        }
+
+        ~RehashTimer() {
+            _map._rehash_time += std::chrono::steady_clock::now() - _start;
+        }
+
+    private:
+        HashMap &_map;
+        std::chrono::steady_clock::time_point _start;
+    };
+#endif
+
+    struct Position {
+        Slot *slot = nullptr;
+        bool in_old = false;
+    };
+
+    template<class, class, class> friend class MappedHashMap;
+    template<class, class, class> friend class ConcurrentHashMap;
+
+    static const_iterator first_entry(const int8_t *ctrl, const Slot *slots) {
+        const_iterator it(ctrl, slots, nullptr, nullptr);
+        it.skip_free();
+        return it;
+    }
+
+    static const_iterator entry_at(const int8_t *ctrl, const Slot *slot) {
+        return const_iterator(ctrl, slot, nullptr, nullptr);
+    }
+
+    static size_t snapshot_align(size_t offset) {
+        return (offset + 63) / 64 * 64;
+    }
+
+    static int8_t *empty_ctrl() {
+        static int8_t sentinel = SENTINEL;
+        return &sentinel;
+    }
+
+    // Triangular probing over whole groups; visits every group of a power-of-two table.
+    class ProbeSeq {
+    public:
+        ProbeSeq(size_t hash, size_t buckets) : _mask(buckets / ControlGroup::WIDTH - 1),
+                                                _group(hash & _mask) {
+        }
+
+        size_t offset() const {
+            return _group * ControlGroup::WIDTH;
+        }
+
+        void next() {
+            _group = (_group + ++_step) & _mask;
+        }
+
+    private:
+        size_t _mask;
+        size_t _group;
+        size_t _step = 0;
+    };
+
+    // Spreads the user hash so that both the group index (high bits)
+    // and the 7-bit tag (low bits) stay well distributed.
+    static uint64_t mix(size_t hash) {
+        uint64_t h = static_cast<uint64_t>(hash);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static size_t h1(uint64_t h) {
+        return static_cast<size_t>(h >> 7);
+    }
+
+    static int8_t h2(uint64_t h) {
+        return static_cast<int8_t>(h & 0x7F);
+    }
+
+    static bool is_full(int8_t c) {
+        return c >= 0;
+    }
+
+    uint64_t hash_of(const KeyType &key) const {
+        return mix(_hasher(key));
+    }
+
+    uint64_t slot_hash(const Slot &slot) const {
+        if constexpr (CACHE_HASH) {
+            return slot.hash;
+        } else {
+            return hash_of(slot.value.first);
+        }
+    }
+
+    static bool same_hash(const Slot &slot, uint64_t h) {
+        if constexpr (CACHE_HASH) {
+            return slot.hash == h;
+        } else {
+            return true;
+        }
+    }
+
+    static void set_hash(Slot &slot, uint64_t h) {
+        if constexpr (CACHE_HASH) {
+            slot.hash = h;
+        }
+    }
+
+    // The load of the current table (tombstones included) stays under 7/8,
+    // so every probe sequence is guaranteed to reach an EMPTY slot.
+    bool needs_growth() const {
+        return (act_size - _old_size + _deleted + 1) * 8 > buckets * 7;
+    }
+
+    // With cached hashes the full 64 bits are compared before the key,
+    // so a tag collision almost never reaches KeyType::operator==.
+    static Slot *find_in(const int8_t *ctrl, Slot *slots, size_t count,
+                               const KeyType &key, uint64_t h) {
+        if (count == 0) {
+            return nullptr;
+        }
+        for (ProbeSeq seq(h1(h), count);; seq.next()) {
+            ControlGroup group(ctrl + seq.offset());
+            for (auto bits = group.match(h2(h)); bits; bits.clear_lowest()) {
+                size_t i = seq.offset() + bits.lowest();
+                if (same_hash(slots[i], h) && slots[i].value.first == key) {
+                    return slots + i;
+                }
+            }
+            if (group.match_empty()) {
+                return nullptr;
+            }
+        }
+    }
+
+    static size_t find_free_in(const int8_t *ctrl, size_t count, uint64_t h) {
+        for (ProbeSeq seq(h1(h), count);; seq.next()) {
+            auto bits = ControlGroup(ctrl + seq.offset()).match_free();
+            if (bits) {
+                return seq.offset() + bits.lowest();
+            }
+        }
+    }
+
+    Position lookup(const KeyType &key, uint64_t h) const {
+        if (Slot *slot = find_in(_ctrl, _slots, buckets, key, h)) {
+            return {slot, false};
+        }
+        return {find_in(_old_ctrl, _old_slots, _old_buckets, key, h), true};
+    }
+
+    // The *_hashed operations take the mixed hash precomputed, for
+    // ConcurrentHashMap, which picks a shard with it first.
+    iterator find_hashed(const KeyType &__key, uint64_t h) {
+        return make_iterator<iterator>(lookup(__key, h));
+    }
+
+    const_iterator find_hashed(const KeyType &__key, uint64_t h) const {
+        return make_iterator<const_iterator>(lookup(__key, h));
+    }
+
+    template<class It>
+    It make_iterator(Position pos) const {
+        if (pos.slot == nullptr) {
+            return end_iterator<It>();
+        }
+        if (pos.in_old) {
+            return It(_old_ctrl + (pos.slot - _old_slots), pos.slot, nullptr, nullptr);
+        }
+        return It(_ctrl + (pos.slot - _slots), pos.slot, _old_ctrl, _old_slots);
+    }
+
+    template<class It>
+    It begin_iterator() const {
+        It it(_ctrl, _slots, _old_ctrl, _old_slots);
+        it.skip_free();
+        return it;
+    }
+
+    template<class It>
+    It end_iterator() const {
+        if (_old_buckets != 0) {
+            return It(_old_ctrl + _old_buckets, _old_slots + _old_buckets, nullptr, nullptr);
+        }
+        return It(_ctrl + buckets, _slots + buckets, nullptr, nullptr);
+    }
+
+    static void prefetch(const void *p) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(p);
+#elif defined(__AVX2__) || defined(HASHMAP_SSE2)
+        _mm_prefetch(static_cast<const char *>(p), _MM_HINT_T0);
+#endif
+    }
+
+    // Pulls in the first control group a probe for h will read.
+    void prefetch_group(uint64_t h) const {
+        if (buckets != 0) {
+            prefetch(_ctrl + ProbeSeq(h1(h), buckets).offset());
+        }
+    }
+
+    // Pulls in the slot of the first tag match, once the group itself is cached.
+    void prefetch_slot(uint64_t h) const {
+        if (buckets == 0) {
+            return;
+        }
+        size_t offset = ProbeSeq(h1(h), buckets).offset();
+        auto bits = ControlGroup(_ctrl + offset).match(h2(h));
+        if (bits) {
+            prefetch(_slots + offset + bits.lowest());
+        }
+    }
+
+    // Batched lookups run in three passes over BATCH keys: hash and prefetch
+    // the control groups, match tags and prefetch candidate slots, then
+    // resolve. The cache misses of a whole batch overlap instead of queuing.
+    template<class It, class KeyIt, class OutIt>
+    OutIt find_batch_impl(KeyIt first, KeyIt last, OutIt out) const {
+        uint64_t hashes[BATCH];
+        while (first != last) {
+            KeyIt batch = first;
+            size_t n = 0;
+            for (; n < BATCH && first != last; ++n, ++first) {
+                hashes[n] = hash_of(*first);
+                prefetch_group(hashes[n]);
+            }
+            for (size_t j = 0; j < n; ++j) {
+                prefetch_slot(hashes[j]);
+            }
+            for (size_t j = 0; j < n; ++j, ++batch) {
+                *out++ = make_iterator<It>(lookup(*batch, hashes[j]));
+            }
+        }
+        return out;
+    }
+
+    // Returns a free slot of the current table for a key known to be absent,
+    // growing the table or advancing a pending migration first.
+    size_t prepare_insert(uint64_t h) {
+        if (_old_buckets != 0) {
+            migrate(MIGRATE_STEP);
+        }
+        if (needs_growth()) {
+            grow();
+        }
+        return find_free_in(_ctrl, buckets, h);
+    }
+
+    template<class... Args>
+    void construct_at(size_t i, uint64_t h, Args &&... args) {
+        new(&_slots[i].value) value_type(std::forward<Args>(args)...);
+        set_hash(_slots[i], h);
+        if (_ctrl[i] == DELETED) {
+            --_deleted;
+        }
+        _ctrl[i] = h2(h);
+        ++act_size;
+    }
+
+    // Every insertion path funnels through here, hashing the key exactly once.
+    template<class K, class... Args>
+    std::pair<iterator, bool> emplace_key(K &&key, Args &&... args) {
+        return emplace_hashed(hash_of(key), std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+    template<class K, class... Args>
+    std::pair<iterator, bool> emplace_hashed(uint64_t h, K &&key, Args &&... args) {
+        Position pos = lookup(key, h);
+        if (pos.slot != nullptr) {
+            return {make_iterator<iterator>(pos), false};
+        }
+        size_t i = prepare_insert(h);
+        construct_at(i, h, std::piecewise_construct,
+                     std::forward_as_tuple(std::forward<K>(key)),
+                     std::forward_as_tuple(std::forward<Args>(args)...));
+        return {make_iterator<iterator>({_slots + i, false}), true};
+    }
+
+    template<class K, class M>
+    std::pair<iterator, bool> assign_key(K &&key, M &&obj) {
+        return assign_hashed(hash_of(key), std::forward<K>(key), std::forward<M>(obj));
+    }
+
+    template<class K, class M>
+    std::pair<iterator, bool> assign_hashed(uint64_t h, K &&key, M &&obj) {
+        Position pos = lookup(key, h);
+        if (pos.slot != nullptr) {
+            pos.slot->value.second = std::forward<M>(obj);
+            return {make_iterator<iterator>(pos), false};
+        }
+        size_t i = prepare_insert(h);
+        construct_at(i, h, std::forward<K>(key), std::forward<M>(obj));
+        return {make_iterator<iterator>({_slots + i, false}), true};
+    }
+
+    void erase_at(Position pos) {
+        pos.slot->value.~value_type();
+        --act_size;
+        if (pos.in_old) {
+            // The old table never takes inserts, so a tombstone is all it needs.
+            _old_ctrl[pos.slot - _old_slots] = DELETED;
+            --_old_size;
+            return;
+        }
+        size_t i = pos.slot - _slots;
+        // No probe ever passed a group that still has an EMPTY slot,
+        // so a slot in such a group can be freed outright.
+        if (ControlGroup(_ctrl + i / ControlGroup::WIDTH * ControlGroup::WIDTH).match_empty()) {
+            _ctrl[i] = EMPTY;
+        } else {
+            _ctrl[i] = DELETED;
+            ++_deleted;
+        }
+    }
+
+    size_t erase_hashed(const KeyType &__key, uint64_t h) {
+        Position pos = lookup(__key, h);
+        if (pos.slot != nullptr) {
+            erase_at(pos);
+        }
+        if (_old_buckets != 0) {
+            migrate(MIGRATE_STEP);
+        }
+        return pos.slot != nullptr;
+    }
+
+    // The current size, doubled until n entries fit under the 7/8 load limit.
+    size_t buckets_for(size_t n) const {
+        size_t new_buckets = buckets == 0 ? START : buckets;
+        while ((n + 1) * 8 > new_buckets * 7) {
+            new_buckets *= 2;
+        }
+        return new_buckets;
+    }
+
+    size_t target_buckets() const {
+        size_t new_buckets = buckets == 0 ? START : buckets;
+        while ((act_size + 1) * 2 > new_buckets) {
+            new_buckets *= 2;
+        }
+        return new_buckets;
+    }
+
+    void grow() {
+        if (_incremental && buckets != 0) {
+            finish_migration();
+            start_migration(target_buckets());
+        } else {
+            resize(target_buckets());
+        }
+    }
+
+    void resize(size_t new_buckets) {
+        finish_migration();
+        start_migration(new_buckets);
+        finish_migration();
+    }
+
+    // Parks the current table as the old one and installs an empty table of new_buckets.
+    void start_migration(size_t new_buckets) {
+#ifdef HASHMAP_STATS
+        RehashTimer timer(*this);
+#endif
+        // Both arrays are allocated before any member changes, so a throwing
+        // allocator leaves the map exactly as it was.
+        CtrlAlloc ctrl_alloc(_alloc);
+        CtrlBlock *ctrl_blocks_ptr = ctrl_alloc.allocate(ctrl_blocks(new_buckets));
+        SlotAlloc slot_alloc(_alloc);
+        Slot *slots;
+        try {
+            slots = slot_alloc.allocate(new_buckets);
+        } catch (...) {
+            ctrl_alloc.deallocate(ctrl_blocks_ptr, ctrl_blocks(new_buckets));
+            throw;
+        }
+        int8_t *ctrl = reinterpret_cast<int8_t *>(ctrl_blocks_ptr);
+        std::fill(ctrl, ctrl + new_buckets, EMPTY);
+        ctrl[new_buckets] = SENTINEL;
+#ifdef HASHMAP_STATS
+        ++_rehashes;
+        _bytes_allocated += table_bytes(new_buckets);
+#endif
+
+        _old_ctrl = _ctrl;
+        _old_slots = _slots;
+        _old_buckets = buckets;
+        _old_size = act_size;
+        _migrated = 0;
+        _ctrl = ctrl;
+        _slots = slots;
+        buckets = new_buckets;
+        _deleted = 0;
+    }
+
+    // Moves up to count old-table slots into the current table.
+    void migrate(size_t count) {
+#ifdef HASHMAP_STATS
+        RehashTimer timer(*this);
+#endif
+        size_t last = std::min(_old_buckets, _migrated + count);
+        for (; _migrated < last; ++_migrated) {
+            if (!is_full(_old_ctrl[_migrated])) {
+                continue;
+            }
+            Slot &src = _old_slots[_migrated];
+            uint64_t h = slot_hash(src);
+            size_t i = find_free_in(_ctrl, buckets, h);
+            new(&_slots[i].value) value_type(std::move(const_cast<KeyType &>(src.value.first)),
+                                             std::move(src.value.second));
+            set_hash(_slots[i], h);
+            if (_ctrl[i] == DELETED) {
+                --_deleted;
+            }
+            _ctrl[i] = h2(h);
+            src.value.~value_type();
+            _old_ctrl[_migrated] = DELETED;
+            --_old_size;
+        }
+        if (_migrated == _old_buckets) {
+            release(_old_ctrl, _old_slots, _old_buckets);
+            _old_ctrl = nullptr;
+            _old_slots = nullptr;
+            _old_buckets = 0;
+            _old_size = 0;
+            _migrated = 0;
+        }
+    }
+
+    void finish_migration() {
+        migrate(_old_buckets);
+    }
+
+    static size_t ctrl_blocks(size_t count) {
+        return count / ControlGroup::WIDTH + 1;
+    }
+
+    static size_t table_bytes(size_t count) {
+        return count == 0 ? 0 : count * sizeof(Slot) + ctrl_blocks(count) * sizeof(CtrlBlock);
+    }
+
+    void add_probe_lengths(const int8_t *ctrl, const Slot *slots, size_t count,
+                           std::vector<size_t> &histogram) const {
+        for (size_t i = 0; i < count; ++i) {
+            if (!is_full(ctrl[i])) {
+                continue;
+            }
+            size_t length = 0;
+            for (ProbeSeq seq(h1(slot_hash(slots[i])), count);
+                 seq.offset() != i / ControlGroup::WIDTH * ControlGroup::WIDTH; seq.next()) {
+                ++length;
+            }
+            ++histogram[std::min(length, histogram.size() - 1)];
+        }
+    }
+
+    void release(int8_t *ctrl, Slot *slots, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        CtrlAlloc ctrl_alloc(_alloc);
+        ctrl_alloc.deallocate(reinterpret_cast<CtrlBlock *>(ctrl), ctrl_blocks(count));
+        SlotAlloc slot_alloc(_alloc);
+        slot_alloc.deallocate(slots, count);
+    }
+
+    void destroy_table(int8_t *ctrl, Slot *slots, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            if (is_full(ctrl[i])) {
+                slots[i].value.~value_type();
+            }
+        }
+        release(ctrl, slots, count);
+    }
+
+    void destroy_all() {
+        destroy_table(_ctrl, _slots, buckets);
+        destroy_table(_old_ctrl, _old_slots, _old_buckets);
+        _ctrl = empty_ctrl();
+        _slots = nullptr;
+        buckets = 0;
+        act_size = 0;
+        _deleted = 0;
+        _old_ctrl = nullptr;
+        _old_slots = nullptr;
+        _old_buckets = 0;
+        _old_size = 0;
+        _migrated = 0;
+    }
 
 public:
     Hash hash_function() const {
         return _hasher;
     }
 
-    HashMap(Hash h = Hash()) : _hasher(h) {
+    allocator_type get_allocator() const {
+        return _alloc;
+    }
+
+    HashMap(Hash h = Hash(), const Alloc &alloc = Alloc()) : _hasher(h), _alloc(alloc) {
     }
 
     template<class Iter>
-    HashMap(Iter begin, Iter end, Hash h = Hash()) : _hasher(h) {
+    HashMap(Iter begin, Iter end, Hash h = Hash(), const Alloc &alloc = Alloc()) :
+            _hasher(h), _alloc(alloc) {
         while (begin != end)
             insert(*begin++);
     }
 
     HashMap(const HashMap &other) :
-            HashMap(other.begin(), other.end(), other._hasher) {
+            HashMap(other.begin(), other.end(), other._hasher, other._alloc) {
+        _incremental = other._incremental;
     }
 
-    HashMap(std::initializer_list<std::pair<const KeyType, ValueType>> init, Hash h = Hash()) :
-            HashMap(init.begin(), init.end(), h) {
+    HashMap(HashMap &&other) noexcept : _hasher(other._hasher), _alloc(other._alloc) {
+        swap(other);
+    }
+
+    HashMap(std::initializer_list<std::pair<const KeyType, ValueType>> init, Hash h = Hash(),
+            const Alloc &alloc = Alloc()) :
+            HashMap(init.begin(), init.end(), h, alloc) {
     }
 
     HashMap &operator=(const HashMap &other) {
         if (this != &other) {
             clear();
             _hasher = other._hasher;
-            for (auto i : other)
+            _incremental = other._incremental;
+            for (auto &i : other)
                 insert(i);
             return *this;
         }
         return *this;
     }
 
+    HashMap &operator=(HashMap &&other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~HashMap() {
+        destroy_all();
+    }
+
+    void swap(HashMap &other) noexcept {
+        std::swap(_ctrl, other._ctrl);
+        std::swap(_slots, other._slots);
+        std::swap(_hasher, other._hasher);
+        std::swap(_alloc, other._alloc);
+        std::swap(buckets, other.buckets);
+        std::swap(act_size, other.act_size);
+        std::swap(_deleted, other._deleted);
+        std::swap(_old_ctrl, other._old_ctrl);
+        std::swap(_old_slots, other._old_slots);
+        std::swap(_old_buckets, other._old_buckets);
+        std::swap(_old_size, other._old_size);
+        std::swap(_migrated, other._migrated);
+        std::swap(_incremental, other._incremental);
+#ifdef HASHMAP_STATS
+        std::swap(_rehashes, other._rehashes);
+        std::swap(_rehash_time, other._rehash_time);
+        std::swap(_bytes_allocated, other._bytes_allocated);
+#endif
+    }
+
+    // In incremental mode growth only allocates the bigger table; the old one
+    // is drained a few groups per insert or erase, so no single call pays for
+    // the whole rehash. Inserts and erases may then move any entry and
+    // invalidate iterators; lookups never do.
+    void set_incremental_rehash(bool enabled) {
+        if (!enabled) {
+            finish_migration();
+        }
+        _incremental = enabled;
+    }
+
+    bool incremental_rehash() const {
+        return _incremental;
+    }
+
+    // Walks every entry to build the probe histogram, so it costs a full
+    // pass (and one hash per entry); meant for diagnostics, not hot paths.
+    HashMapStats stats(size_t histogram_size = 8) const {
+        HashMapStats result;
+        result.size = act_size;
+        result.buckets = buckets + _old_buckets;
+        result.tombstones = _deleted;
+        result.load_factor = buckets == 0 ? 0 : static_cast<double>(act_size - _old_size) / buckets;
+        result.probe_histogram.assign(std::max<size_t>(histogram_size, 1), 0);
+        add_probe_lengths(_ctrl, _slots, buckets, result.probe_histogram);
+        add_probe_lengths(_old_ctrl, _old_slots, _old_buckets, result.probe_histogram);
+        result.bytes_in_use = table_bytes(buckets) + table_bytes(_old_buckets);
+        result.incremental_rehash_pending = _old_buckets != 0;
+#ifdef HASHMAP_STATS
+        result.rehashes = _rehashes;
+        result.rehash_seconds = std::chrono::duration<double>(_rehash_time).count();
+        result.bytes_allocated = _bytes_allocated;
+#endif
+        return result;
+    }
+
+    // Writes a compact, tombstone-free image of the table that
+    // MappedHashMap can probe straight from a read-only mapping. Keys and
+    // values are copied bytewise. A trivially copyable Hash (e.g. a seeded
+    // FastHash) is stored with the image; any other must hash the same way
+    // in the process that maps the file.
+    void save(std::ostream &out) const {
+        static_assert(std::is_trivially_copyable<KeyType>::value &&
+                      std::is_trivially_copyable<ValueType>::value,
+                      "snapshots need trivially copyable keys and values");
+        size_t count = START;
+        while ((act_size + 1) * 8 > count * 7) {
+            count *= 2;
+        }
+        std::vector<CtrlBlock> ctrl_blocks_buf(ctrl_blocks(count));
+        int8_t *ctrl = reinterpret_cast<int8_t *>(ctrl_blocks_buf.data());
+        std::fill(ctrl, ctrl + count, EMPTY);
+        std::fill(ctrl + count, ctrl + ctrl_blocks(count) * ControlGroup::WIDTH, SENTINEL);
+        std::allocator<Slot> slot_alloc;
+        std::unique_ptr<Slot, std::function<void(Slot *)>> slots(
+                slot_alloc.allocate(count), [&](Slot *p) { slot_alloc.deallocate(p, count); });
+        std::memset(static_cast<void *>(slots.get()), 0, count * sizeof(Slot));
+        for (auto it = begin(); it != end(); ++it) {
+            uint64_t h = slot_hash(*it._slot);
+            size_t i = find_free_in(ctrl, count, h);
+            ctrl[i] = h2(h);
+            new(&slots.get()[i].value) value_type(*it);
+            set_hash(slots.get()[i], h);
+        }
+
+        HashMapSnapshotHeader header;
+        header.key_size = sizeof(KeyType);
+        header.value_size = sizeof(ValueType);
+        header.slot_size = sizeof(Slot);
+        if constexpr (std::is_trivially_copyable<Hash>::value && sizeof(Hash) <= sizeof(header.hasher)) {
+            header.hasher_size = sizeof(Hash);
+            std::memcpy(header.hasher, static_cast<const void *>(&_hasher), sizeof(Hash));
+        }
+        header.buckets = count;
+        header.size = act_size;
+        header.ctrl_offset = snapshot_align(sizeof(header));
+        header.slots_offset = snapshot_align(header.ctrl_offset + ctrl_blocks(count) * sizeof(CtrlBlock));
+        header.file_size = header.slots_offset + count * sizeof(Slot);
+
+        const char padding[64] = {};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(padding, header.ctrl_offset - sizeof(header));
+        out.write(reinterpret_cast<const char *>(ctrl), ctrl_blocks(count) * sizeof(CtrlBlock));
+        out.write(padding, header.slots_offset - header.ctrl_offset - ctrl_blocks(count) * sizeof(CtrlBlock));
+        out.write(reinterpret_cast<const char *>(slots.get()), count * sizeof(Slot));
+    }
+
+    void save(const std::string &path) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        save(out);
+        if (!out) {
+            throw std::runtime_error("cannot write HashMap snapshot " + path);
+        }
+    }
+
     iterator begin() {
-        return _data.begin();
+        return begin_iterator<iterator>();
     }
 
     const_iterator begin() const {
-        return _data.begin();
+        return begin_iterator<const_iterator>();
     }
 
     iterator end() {
-        return _data.end();
+        return end_iterator<iterator>();
     }
 
     const_iterator end() const {
-        return _data.end();
+        return end_iterator<const_iterator>();
     }
 
     size_t size() const {
@@ -76,118 +1184,166 @@ public:
         return act_size == 0;
     }
 
-    iterator find(const KeyType __key) {
-        if (buckets == 0) {
-            return _data.end();
-        }
-        auto key = _hasher(__key) % buckets;
-        auto st = iters[key];
-        for (size_t i = 0; i < sz[key]; ++i, ++st) {
-            if (st->first == __key) {
-                return st;
-            }
-        }
-        return _data.end();
+    iterator find(const KeyType &__key) {
+        return find_hashed(__key, hash_of(__key));
     }
 
-    const_iterator find(const KeyType __key) const {
-        if (buckets == 0) {
-            return _data.end();
-        }
-        auto key = _hasher(__key) % buckets;
-        auto st = iters[key];
-        for (size_t i = 0; i < sz[key]; ++i, ++st) {
-            if (st->first == __key) {
-                return st;
-            }
-        }
-        return _data.end();
+    const_iterator find(const KeyType &__key) const {
+        return find_hashed(__key, hash_of(__key));
     }
 
-    void insert(std::pair<const KeyType, ValueType> p) {
-        if (buckets == 0) {
-            rehash();
-        }
-        if (find(p.first) != _data.end()) {
-            return;
+    std::pair<iterator, bool> insert(const value_type &p) {
+        return emplace_key(p.first, p.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&p) {
+        return emplace_key(p.first, std::move(p.second));
+    }
+
+    template<class P, class = std::enable_if_t<std::is_constructible<value_type, P &&>::value &&
+                                               !std::is_same<std::decay_t<P>, value_type>::value>>
+    std::pair<iterator, bool> insert(P &&p) {
+        return emplace(std::forward<P>(p));
+    }
+
+    // A (key, value) pair is looked up before anything is built; other
+    // argument lists construct the entry once and then move it into place.
+    template<class K, class V>
+    std::pair<iterator, bool> emplace(K &&k, V &&v) {
+        if constexpr (std::is_same<std::decay_t<K>, KeyType>::value) {
+            return emplace_key(std::forward<K>(k), std::forward<V>(v));
+        } else {
+            return emplace_key(KeyType(std::forward<K>(k)), std::forward<V>(v));
         }
-        auto key = _hasher(p.first) % buckets;
-        if (sz[key] == 0) {
-            ++act_size;
-            _data.insert(_data.end(), p);
-            iters[key] = _data.end();
-            iters[key]--;
-            sz[key] = 1;
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        value_type entry(std::forward<Args>(args)...);
+        return emplace_key(std::move(const_cast<KeyType &>(entry.first)), std::move(entry.second));
+    }
+
+    // Unlike emplace, never constructs the value when the key is present.
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(const KeyType &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(KeyType &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template<class M>
+    std::pair<iterator, bool> insert_or_assign(const KeyType &key, M &&obj) {
+        return assign_key(key, std::forward<M>(obj));
+    }
+
+    template<class M>
+    std::pair<iterator, bool> insert_or_assign(KeyType &&key, M &&obj) {
+        return assign_key(std::move(key), std::forward<M>(obj));
+    }
+
+    size_t erase(const KeyType &__key) {
+        return erase_hashed(__key, hash_of(__key));
+    }
+
+    // Writes find(key) for every key of the forward range [first, last) to out.
+    template<class KeyIt, class OutIt>
+    OutIt find_batch(KeyIt first, KeyIt last, OutIt out) {
+        return find_batch_impl<iterator>(first, last, out);
+    }
+
+    template<class KeyIt, class OutIt>
+    OutIt find_batch(KeyIt first, KeyIt last, OutIt out) const {
+        return find_batch_impl<const_iterator>(first, last, out);
+    }
+
+    template<class KeyRange, class OutIt>
+    OutIt find_batch(const KeyRange &keys, OutIt out) {
+        return find_batch(std::begin(keys), std::end(keys), out);
+    }
+
+    template<class KeyRange, class OutIt>
+    OutIt find_batch(const KeyRange &keys, OutIt out) const {
+        return find_batch(std::begin(keys), std::end(keys), out);
+    }
+
+    // Inserts every pair of [first, last) that is not present yet. Room is
+    // made up front so that no batch is split by a rehash; in incremental
+    // mode that is a migration to the final size, moved along by the
+    // inserts themselves, rather than a rehash of everything at once.
+    template<class Iter>
+    void insert_batch(Iter first, Iter last) {
+        size_t n = act_size + static_cast<size_t>(std::distance(first, last));
+        if (_incremental && buckets != 0) {
+            size_t new_buckets = buckets_for(n);
+            if (new_buckets != buckets) {
+                finish_migration();
+                start_migration(new_buckets);
+            }
         } else {
-            ++act_size;
-            ++sz[key];
-            _data.insert(iters[key], p);
-            iters[key]--;
+            reserve(n);
         }
-        if (act_size * 2 >= buckets) {
-            rehash();
+        uint64_t hashes[BATCH];
+        while (first != last) {
+            Iter batch = first;
+            size_t n = 0;
+            for (; n < BATCH && first != last; ++n, ++first) {
+                hashes[n] = hash_of((*first).first);
+                prefetch_group(hashes[n]);
+            }
+            for (size_t j = 0; j < n; ++j, ++batch) {
+                const auto &entry = *batch;
+                emplace_hashed(hashes[j], entry.first, entry.second);
+            }
         }
     }
 
-    void erase(const KeyType __key) {
-        auto it = find(__key);
-        if (it == _data.end()) {
-            return;
-        }
-        auto key = _hasher(__key) % buckets;
-        --sz[key];
-        --act_size;
-        if (sz[key] == 0) {
-            iters[key] = _data.end();
-        } else if (it == iters[key]) {
-            ++iters[key];
+    template<class Range>
+    void insert_batch(const Range &entries) {
+        insert_batch(std::begin(entries), std::end(entries));
+    }
+
+    // Grows the table so that n entries fit without another rehash.
+    void reserve(size_t n) {
+        size_t new_buckets = buckets_for(n);
+        if (new_buckets != buckets) {
+            resize(new_buckets);
         }
-        _data.erase(it);
     }
 
+    // Rebuilds the table in one pass, doubling it when live entries need
+    // the room and otherwise keeping its size while dropping tombstones.
     void rehash() {
-        if (buckets == 0) {
-            iters.resize(START);
-            sz.resize(START);
-            buckets = START;
-        } else {
-            act_size = 0;
-            buckets *= 2;
-            sz.clear();
-            sz.resize(buckets);
-            iters.clear();
-            iters.resize(buckets);
-            std::list<std::pair<const KeyType, ValueType>> ndata;
-            swap(ndata, _data);
-            for (auto i : ndata) {
-                insert(i);
-            }
-            ndata.clear();
-        }
+        resize(target_buckets());
+    }
+
+    ValueType &operator[](const KeyType &__key) {
+        return try_emplace(__key).first->second;
     }
 
-    ValueType &operator[](const KeyType __key) {
+    ValueType &operator[](KeyType &&__key) {
+        return try_emplace(std::move(__key)).first->second;
+    }
+
+    ValueType &at(const KeyType &__key) {
         auto it = find(__key);
-        if (it != _data.end()) {
-            return it->second;
+        if (it == end()) {
+            throw std::out_of_range("OUT OF RANGE");
         }
-        insert({__key, ValueType()});
-        return find(__key)->second;
+        return it->second;
     }
 
-    const ValueType &at(const KeyType __key) const {
+    const ValueType &at(const KeyType &__key) const {
         auto it = find(__key);
-        if (it == _data.end()) {
+        if (it == end()) {
             throw std::out_of_range("OUT OF RANGE");
         }
         return it->second;
     }
 
     void clear() {
-        sz.clear();
-        iters.clear();
-        _data.clear();
-        act_size = 0;
-        buckets = 0;
+        destroy_all();
     }
 };
@@ -0,0 +1,353 @@
+#pragma once
+
+#include "HashMap.cpp"
+#include "PoolAllocator.cpp"
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Default weigher: every entry counts as one, so capacity is an entry count.
+// Pass a weigher returning bytes to bound a cache by memory instead.
+struct UnitWeight {
+    template<class Key, class Value>
+    size_t operator()(const Key &, const Value &) const {
+        return 1;
+    }
+};
+
+// Bounded memoization cache with least-recently-used eviction. The key index
+// is a HashMap; recency is a std::list whose nodes come from the cache's own
+// MemoryPool, so steady-state put/evict cycles recycle nodes instead of
+// calling malloc. A lone entry heavier than the capacity is still kept, so
+// a reference returned by get_or_compute stays valid until the next call.
+// Not thread-safe.
+template<class Key, class Value, class Hash = std::hash<Key>, class Weigher = UnitWeight>
+class LruCache {
+private:
+    struct Node {
+        Key key;
+        Value value;
+        size_t weight;
+    };
+
+    using List = std::list<Node, PoolAllocator<Node>>;
+
+    MemoryPool _pool{64 * 1024};
+    List _order{PoolAllocator<Node>(_pool)};
+    HashMap<Key, typename List::iterator, Hash> _index;
+    Weigher _weigher;
+    size_t _capacity;
+    size_t _weight = 0;
+    size_t _hits = 0;
+    size_t _misses = 0;
+    size_t _evictions = 0;
+    std::function<void(const Key &, Value &)> _on_evict;
+
+    void touch(typename List::iterator it) {
+        _order.splice(_order.begin(), _order, it);
+    }
+
+    void evict_to_fit() {
+        while (_weight > _capacity && _order.size() > 1) {
+            Node &victim = _order.back();
+            if (_on_evict) {
+                _on_evict(victim.key, victim.value);
+            }
+            _weight -= victim.weight;
+            _index.erase(victim.key);
+            _order.pop_back();
+            ++_evictions;
+        }
+    }
+
+public:
+    explicit LruCache(size_t capacity, Hash h = Hash(), Weigher weigher = Weigher()) :
+            _index(h), _weigher(weigher), _capacity(capacity) {
+    }
+
+    LruCache(const LruCache &) = delete;
+
+    LruCache &operator=(const LruCache &) = delete;
+
+    // Called with each entry dropped to make room; explicit erase() does not call it.
+    void on_evict(std::function<void(const Key &, Value &)> callback) {
+        _on_evict = std::move(callback);
+    }
+
+    // Returns the cached value and marks it most recently used, or nullptr.
+    // The pointer is invalidated by the next put.
+    Value *get(const Key &key) {
+        auto it = _index.find(key);
+        if (it == _index.end()) {
+            ++_misses;
+            return nullptr;
+        }
+        ++_hits;
+        touch(it->second);
+        return &it->second->value;
+    }
+
+    // Looks the value up without touching recency or the counters.
+    const Value *peek(const Key &key) const {
+        auto it = _index.find(key);
+        return it == _index.end() ? nullptr : &it->second->value;
+    }
+
+    bool contains(const Key &key) const {
+        return _index.find(key) != _index.end();
+    }
+
+    void put(const Key &key, Value value) {
+        size_t weight = _weigher(key, value);
+        auto result = _index.try_emplace(key);
+        if (!result.second) {
+            Node &node = *result.first->second;
+            _weight = _weight - node.weight + weight;
+            node.value = std::move(value);
+            node.weight = weight;
+            touch(result.first->second);
+        } else {
+            _order.push_front(Node{key, std::move(value), weight});
+            result.first->second = _order.begin();
+            _weight += weight;
+        }
+        evict_to_fit();
+    }
+
+    // The memoization entry point: returns the cached value or stores compute(key).
+    template<class F>
+    Value &get_or_compute(const Key &key, F compute) {
+        if (Value *cached = get(key)) {
+            return *cached;
+        }
+        put(key, compute(key));
+        return _order.front().value;
+    }
+
+    bool erase(const Key &key) {
+        auto it = _index.find(key);
+        if (it == _index.end()) {
+            return false;
+        }
+        _weight -= it->second->weight;
+        _order.erase(it->second);
+        _index.erase(key);
+        return true;
+    }
+
+    void clear() {
+        _index.clear();
+        _order.clear();
+        _weight = 0;
+    }
+
+    void set_capacity(size_t capacity) {
+        _capacity = capacity;
+        evict_to_fit();
+    }
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    size_t size() const {
+        return _order.size();
+    }
+
+    bool empty() const {
+        return _order.empty();
+    }
+
+    size_t weight() const {
+        return _weight;
+    }
+
+    size_t hits() const {
+        return _hits;
+    }
+
+    size_t misses() const {
+        return _misses;
+    }
+
+    size_t evictions() const {
+        return _evictions;
+    }
+};
+
+// CLOCK approximation of LRU: a hit only sets a reference bit, and eviction
+// sweeps a hand over the entries, sparing (and clearing) referenced ones.
+// Hits never relink anything, which makes them cheaper than in LruCache.
+template<class Key, class Value, class Hash = std::hash<Key>, class Weigher = UnitWeight>
+class ClockCache {
+private:
+    struct Entry {
+        Key key;
+        std::optional<Value> value;
+        size_t weight = 0;
+        bool referenced = false;
+    };
+
+    std::vector<Entry> _entries;
+    std::vector<size_t> _free;
+    HashMap<Key, size_t, Hash> _index;
+    Weigher _weigher;
+    size_t _capacity;
+    size_t _weight = 0;
+    size_t _size = 0;
+    size_t _hand = 0;
+    size_t _hits = 0;
+    size_t _misses = 0;
+    size_t _evictions = 0;
+    std::function<void(const Key &, Value &)> _on_evict;
+
+    void remove(size_t i) {
+        Entry &entry = _entries[i];
+        _weight -= entry.weight;
+        _index.erase(entry.key);
+        entry.value.reset();
+        _free.push_back(i);
+        --_size;
+    }
+
+    // Sweeps until the weight fits, never evicting the entry at keep.
+    void evict_to_fit(size_t keep) {
+        while (_weight > _capacity && _size > 1) {
+            _hand = (_hand + 1) % _entries.size();
+            Entry &entry = _entries[_hand];
+            if (!entry.value || _hand == keep) {
+                continue;
+            }
+            if (entry.referenced) {
+                entry.referenced = false;
+                continue;
+            }
+            if (_on_evict) {
+                _on_evict(entry.key, *entry.value);
+            }
+            remove(_hand);
+            ++_evictions;
+        }
+    }
+
+public:
+    explicit ClockCache(size_t capacity, Hash h = Hash(), Weigher weigher = Weigher()) :
+            _index(h), _weigher(weigher), _capacity(capacity) {
+    }
+
+    void on_evict(std::function<void(const Key &, Value &)> callback) {
+        _on_evict = std::move(callback);
+    }
+
+    Value *get(const Key &key) {
+        auto it = _index.find(key);
+        if (it == _index.end()) {
+            ++_misses;
+            return nullptr;
+        }
+        ++_hits;
+        Entry &entry = _entries[it->second];
+        entry.referenced = true;
+        return &*entry.value;
+    }
+
+    const Value *peek(const Key &key) const {
+        auto it = _index.find(key);
+        return it == _index.end() ? nullptr : &*_entries[it->second].value;
+    }
+
+    bool contains(const Key &key) const {
+        return _index.find(key) != _index.end();
+    }
+
+    void put(const Key &key, Value value) {
+        size_t weight = _weigher(key, value);
+        auto result = _index.try_emplace(key);
+        size_t i;
+        if (!result.second) {
+            i = result.first->second;
+            _weight -= _entries[i].weight;
+            _entries[i].value = std::move(value);
+        } else {
+            if (_free.empty()) {
+                i = _entries.size();
+                _entries.push_back(Entry{key, std::move(value)});
+            } else {
+                i = _free.back();
+                _free.pop_back();
+                _entries[i].key = key;
+                _entries[i].value = std::move(value);
+            }
+            result.first->second = i;
+            ++_size;
+        }
+        _entries[i].weight = weight;
+        _entries[i].referenced = false;
+        _weight += weight;
+        evict_to_fit(i);
+    }
+
+    template<class F>
+    Value &get_or_compute(const Key &key, F compute) {
+        if (Value *cached = get(key)) {
+            return *cached;
+        }
+        put(key, compute(key));
+        return *_entries[_index.find(key)->second].value;
+    }
+
+    bool erase(const Key &key) {
+        auto it = _index.find(key);
+        if (it == _index.end()) {
+            return false;
+        }
+        remove(it->second);
+        return true;
+    }
+
+    void clear() {
+        _entries.clear();
+        _free.clear();
+        _index.clear();
+        _weight = 0;
+        _size = 0;
+        _hand = 0;
+    }
+
+    void set_capacity(size_t capacity) {
+        _capacity = capacity;
+        evict_to_fit(_entries.size());
+    }
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    size_t weight() const {
+        return _weight;
+    }
+
+    size_t hits() const {
+        return _hits;
+    }
+
+    size_t misses() const {
+        return _misses;
+    }
+
+    size_t evictions() const {
+        return _evictions;
+    }
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "HashMap.cpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only view of a file written by HashMap::save(). The file is mapped
+// as is and find() probes the mapped control bytes and slots directly, so
+// opening costs one mmap no matter how many entries the image holds.
+// A trivially copyable Hash saved with the image (such as a seeded
+// FastHash) replaces the one passed to the constructor.
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>>
+class MappedHashMap {
+private:
+    using Map = HashMap<KeyType, ValueType, Hash>;
+    using Slot = typename Map::Slot;
+    using CtrlBlock = typename Map::CtrlBlock;
+
+public:
+    using value_type = typename Map::value_type;
+    using const_iterator = typename Map::const_iterator;
+
+    explicit MappedHashMap(const std::string &path, Hash h = Hash()) : _hasher(h) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open HashMap snapshot " + path);
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(HashMapSnapshotHeader)) {
+            ::close(fd);
+            throw std::runtime_error("truncated HashMap snapshot " + path);
+        }
+        _length = static_cast<size_t>(st.st_size);
+        void *base = ::mmap(nullptr, _length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("cannot map HashMap snapshot " + path);
+        }
+        _base = static_cast<const char *>(base);
+        try {
+            validate();
+        } catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    MappedHashMap(const MappedHashMap &) = delete;
+
+    MappedHashMap &operator=(const MappedHashMap &) = delete;
+
+    MappedHashMap(MappedHashMap &&other) noexcept {
+        swap(other);
+    }
+
+    MappedHashMap &operator=(MappedHashMap &&other) noexcept {
+        if (this != &other) {
+            unmap();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~MappedHashMap() {
+        unmap();
+    }
+
+    void swap(MappedHashMap &other) noexcept {
+        std::swap(_base, other._base);
+        std::swap(_length, other._length);
+        std::swap(_ctrl, other._ctrl);
+        std::swap(_slots, other._slots);
+        std::swap(buckets, other.buckets);
+        std::swap(act_size, other.act_size);
+        std::swap(_hasher, other._hasher);
+    }
+
+    size_t size() const {
+        return act_size;
+    }
+
+    bool empty() const {
+        return act_size == 0;
+    }
+
+    const_iterator begin() const {
+        return Map::first_entry(_ctrl, _slots);
+    }
+
+    const_iterator end() const {
+        return Map::entry_at(_ctrl + buckets, _slots + buckets);
+    }
+
+    const_iterator find(const KeyType &__key) const {
+        Slot *slot = Map::find_in(_ctrl, const_cast<Slot *>(_slots), buckets, __key,
+                                  Map::mix(_hasher(__key)));
+        if (slot == nullptr) {
+            return end();
+        }
+        return Map::entry_at(_ctrl + (slot - _slots), slot);
+    }
+
+    const ValueType &at(const KeyType &__key) const {
+        auto it = find(__key);
+        if (it == end()) {
+            throw std::out_of_range("OUT OF RANGE");
+        }
+        return it->second;
+    }
+
+private:
+    const char *_base = nullptr;
+    size_t _length = 0;
+    const int8_t *_ctrl = nullptr;
+    const Slot *_slots = nullptr;
+    size_t buckets = 0;
+    size_t act_size = 0;
+    Hash _hasher;
+
+    // Rejects images from another layout: different key/value types, byte
+    // order or SIMD group width would all change where entries are probed.
+    void validate() {
+        HashMapSnapshotHeader header;
+        HashMapSnapshotHeader expected;
+        std::memcpy(&header, _base, sizeof(header));
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+            header.version != expected.version) {
+            throw std::runtime_error("not a HashMap snapshot");
+        }
+        if (header.byte_order != expected.byte_order || header.group_width != expected.group_width ||
+            header.key_size != sizeof(KeyType) || header.value_size != sizeof(ValueType) ||
+            header.slot_size != sizeof(Slot)) {
+            throw std::runtime_error("HashMap snapshot layout does not match this build");
+        }
+        // Every byte a probe or an iterator can touch must lie inside the
+        // mapping: the control bytes run to a full group past the last
+        // bucket, and the arrays must be aligned for the group loads. The
+        // probe sequence walks whole groups, so there must be at least one.
+        if (header.file_size > _length || header.buckets < ControlGroup::WIDTH || header.buckets > _length ||
+            (header.buckets & (header.buckets - 1)) != 0 || header.buckets % ControlGroup::WIDTH != 0 ||
+            header.ctrl_offset > _length ||
+            Map::ctrl_blocks(header.buckets) * sizeof(CtrlBlock) > _length - header.ctrl_offset ||
+            header.buckets + ControlGroup::WIDTH > _length - header.ctrl_offset ||
+            header.ctrl_offset % alignof(CtrlBlock) != 0 ||
+            header.slots_offset > _length ||
+            header.buckets > (_length - header.slots_offset) / sizeof(Slot) ||
+            header.slots_offset % alignof(Slot) != 0) {
+            throw std::runtime_error("corrupt HashMap snapshot");
+        }
+        if (static_cast<int8_t>(_base[header.ctrl_offset + header.buckets]) != Map::SENTINEL) {
+            throw std::runtime_error("corrupt HashMap snapshot");
+        }
+        // A lookup only stops at a group with an EMPTY byte, so a table with
+        // none would probe forever. save() keeps the load under 7/8 like the
+        // live table does, and every byte is a tag, EMPTY or DELETED.
+        const int8_t *ctrl = reinterpret_cast<const int8_t *>(_base + header.ctrl_offset);
+        size_t empty = 0;
+        size_t full = 0;
+        for (size_t i = 0; i < header.buckets; ++i) {
+            if (ctrl[i] >= 0) {
+                ++full;
+            } else if (ctrl[i] == Map::EMPTY) {
+                ++empty;
+            } else if (ctrl[i] != Map::DELETED) {
+                throw std::runtime_error("corrupt HashMap snapshot");
+            }
+        }
+        if (empty == 0 || full != header.size || header.size > header.buckets / 8 * 7) {
+            throw std::runtime_error("corrupt HashMap snapshot");
+        }
+        _ctrl = ctrl;
+        _slots = reinterpret_cast<const Slot *>(_base + header.slots_offset);
+        buckets = header.buckets;
+        act_size = header.size;
+        if constexpr (std::is_trivially_copyable<Hash>::value) {
+            if (header.hasher_size == sizeof(Hash)) {
+                std::memcpy(static_cast<void *>(&_hasher), header.hasher, sizeof(Hash));
+            }
+        }
+    }
+
+    void unmap() {
+        if (_base != nullptr) {
+            ::munmap(const_cast<char *>(_base), _length);
+            _base = nullptr;
+        }
+    }
+};
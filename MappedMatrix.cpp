@@ -0,0 +1,153 @@
+#pragma once
+
+#include "Matrix Class.cpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only view of a file written by Matrix::save() or MatrixWriter. The
+// file is mapped as is and the elements are used in place, so opening costs
+// one mmap however large the matrix is; pages are read on first touch and
+// shared with every other process mapping the same file. Only files in this
+// machine's byte order can be mapped (MatrixReader converts the others).
+template <typename T>
+class MappedMatrix {
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "binary Matrix files need trivially copyable elements");
+
+public:
+    explicit MappedMatrix(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open Matrix file " + path);
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(MatrixFileHeader)) {
+            ::close(fd);
+            throw std::runtime_error("truncated Matrix file " + path);
+        }
+        _length = static_cast<size_t>(st.st_size);
+        void *base = ::mmap(nullptr, _length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("cannot map Matrix file " + path);
+        }
+        _base = static_cast<const char *>(base);
+        try {
+            validate();
+        } catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    MappedMatrix(const MappedMatrix &) = delete;
+
+    MappedMatrix &operator=(const MappedMatrix &) = delete;
+
+    MappedMatrix(MappedMatrix &&other) noexcept {
+        swap(other);
+    }
+
+    MappedMatrix &operator=(MappedMatrix &&other) noexcept {
+        if (this != &other) {
+            unmap();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~MappedMatrix() {
+        unmap();
+    }
+
+    void swap(MappedMatrix &other) noexcept {
+        std::swap(_base, other._base);
+        std::swap(_length, other._length);
+        std::swap(_data, other._data);
+        std::swap(_rows, other._rows);
+        std::swap(_cols, other._cols);
+    }
+
+    size_t Rows() const {
+        return _rows;
+    }
+
+    size_t Cols() const {
+        return _cols;
+    }
+
+    const T *data() const {
+        return _data;
+    }
+
+    const T *operator[](size_t i) const {
+        return _data + i * _cols;
+    }
+
+    const T &operator()(size_t i, size_t j) const {
+        return _data[i * _cols + j];
+    }
+
+    // The whole file as a view; rows, columns and submatrices of it are
+    // views too, so nothing is copied until a Matrix is built from one.
+    MatrixView<const T> view() const {
+        return MatrixView<const T>(_data, _rows, _cols, _cols);
+    }
+
+    // Hints the kernel to read ahead for a front-to-back scan.
+    void advise_sequential() const {
+        ::madvise(const_cast<char *>(_base), _length, MADV_SEQUENTIAL);
+    }
+
+private:
+    const char *_base = nullptr;
+    size_t _length = 0;
+    const T *_data = nullptr;
+    size_t _rows = 0;
+    size_t _cols = 0;
+
+    void validate() {
+        MatrixFileHeader header;
+        MatrixFileHeader expected;
+        std::memcpy(&header, _base, sizeof(header));
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+            throw std::runtime_error("not a Matrix file");
+        }
+        if (header.byte_order != expected.byte_order) {
+            throw std::runtime_error("Matrix file byte order does not match");
+        }
+        if (header.version != expected.version) {
+            throw std::runtime_error("unsupported Matrix file version");
+        }
+        if (header.element_kind != static_cast<uint32_t>(matrix_element_kind<T>()) ||
+            header.element_size != sizeof(T)) {
+            throw std::runtime_error("Matrix file element type does not match");
+        }
+        if (header.data_offset < sizeof(header) || header.data_offset > _length ||
+            header.data_offset % alignof(T) != 0 ||
+            (header.cols != 0 && header.rows > (_length - header.data_offset) / sizeof(T) / header.cols)) {
+            throw std::runtime_error("corrupt Matrix file");
+        }
+        _data = reinterpret_cast<const T *>(_base + header.data_offset);
+        _rows = header.rows;
+        _cols = header.cols;
+    }
+
+    void unmap() {
+        if (_base != nullptr) {
+            ::munmap(const_cast<char *>(_base), _length);
+            _base = nullptr;
+        }
+    }
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "Matrix Class.cpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Panel width of the blocked factorizations and triangular solves. Inside a
+// panel the work is row-by-row; everything outside it is one gemm per
+// panel, which is where the O(n^3) flops go.
+constexpr size_t FACTORIZATION_BLOCK = 64;
+
+// C[m x n] -= A[m x k] * B[k x n], through gemm on a negated copy of A.
+template <typename T>
+void gemm_subtract(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc) {
+    if (m == 0 || n == 0 || k == 0) {
+        return;
+    }
+    std::vector<T> negated(m * k);
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t p = 0; p < k; ++p) {
+            negated[i * k + p] = -a[i * lda + p];
+        }
+    }
+    gemm(m, n, k, negated.data(), k, b, ldb, c, ldc);
+}
+
+// Solves L X = B in place of B (n x m, leading dimension ldx) for the lower
+// triangle of a (n x n); unit means the diagonal is taken as ones. Blocks of
+// rows are first updated with everything solved above them in one gemm,
+// then finished with axpys across all right-hand sides at once.
+template <typename T>
+void solve_lower(const T* a, size_t lda, size_t n, T* x, size_t ldx, size_t m, bool unit) {
+    for (size_t kb = 0; kb < n; kb += FACTORIZATION_BLOCK) {
+        size_t ke = std::min(n, kb + FACTORIZATION_BLOCK);
+        gemm_subtract(ke - kb, m, kb, a + kb * lda, lda, x, ldx, x + kb * ldx, ldx);
+        for (size_t i = kb; i < ke; ++i) {
+            for (size_t j = kb; j < i; ++j) {
+                simd_zip(x + i * ldx, x + j * ldx, m, SimdAxpy<T>{-a[i * lda + j]});
+            }
+            if (!unit) {
+                simd_map(x + i * ldx, m, SimdScale<T>{T(1) / a[i * lda + i]});
+            }
+        }
+    }
+}
+
+// Solves U X = B in place of B for the upper triangle of a, bottom block first.
+template <typename T>
+void solve_upper(const T* a, size_t lda, size_t n, T* x, size_t ldx, size_t m, bool unit) {
+    for (size_t ke = n; ke > 0;) {
+        size_t kb = ke > FACTORIZATION_BLOCK ? ke - FACTORIZATION_BLOCK : 0;
+        gemm_subtract(ke - kb, m, n - ke, a + kb * lda + ke, lda, x + ke * ldx, ldx, x + kb * ldx, ldx);
+        for (size_t i = ke; i-- > kb;) {
+            for (size_t j = i + 1; j < ke; ++j) {
+                simd_zip(x + i * ldx, x + j * ldx, m, SimdAxpy<T>{-a[i * lda + j]});
+            }
+            if (!unit) {
+                simd_map(x + i * ldx, m, SimdScale<T>{T(1) / a[i * lda + i]});
+            }
+        }
+        ke = kb;
+    }
+}
+
+// P A = L U with partial pivoting, computed once and reused for any number
+// of solves. Blocked right-looking: each panel of FACTORIZATION_BLOCK
+// columns is factored row by row, the block row of U to its right is a
+// triangular solve, and the trailing submatrix is updated with one gemm.
+// L (unit diagonal, not stored) and U share one n x n matrix.
+template <typename T>
+class LUDecomposition {
+private:
+    Matrix<T> lu;
+    std::vector<size_t> pivots;  // row i of P A is row pivots[i] of A
+    bool negative = false;       // odd number of row swaps
+    bool singular = false;
+
+    // Unblocked LU of columns [k, k + width) for rows k and below. Rows are
+    // swapped over their full length, so the L already computed to the left
+    // and the trailing columns to the right stay consistent.
+    void factor_panel(size_t k, size_t width) {
+        using std::abs;
+        size_t n = lu.Rows();
+        for (size_t j = k; j < k + width; ++j) {
+            size_t p = j;
+            for (size_t i = j + 1; i < n; ++i) {
+                if (abs(lu(i, j)) > abs(lu(p, j))) {
+                    p = i;
+                }
+            }
+            if (p != j) {
+                std::swap_ranges(lu[j], lu[j] + n, lu[p]);
+                std::swap(pivots[j], pivots[p]);
+                negative = !negative;
+            }
+            if (lu(j, j) == T()) {
+                singular = true;
+                continue;
+            }
+            T inverse_pivot = T(1) / lu(j, j);
+            size_t rest = k + width - j - 1;
+            for (size_t i = j + 1; i < n; ++i) {
+                lu(i, j) *= inverse_pivot;
+                simd_zip(lu[i] + j + 1, lu[j] + j + 1, rest, SimdAxpy<T>{-lu(i, j)});
+            }
+        }
+    }
+    void check_solvable(size_t rhs_rows) const {
+        assert(rhs_rows == lu.Rows());
+        if (singular) {
+            throw std::domain_error("matrix is singular");
+        }
+    }
+
+public:
+    explicit LUDecomposition(const Matrix<T>& a) : lu(a), pivots(a.Rows()) {
+        assert(a.Rows() == a.Cols());
+        size_t n = a.Rows();
+        for (size_t i = 0; i < n; ++i) {
+            pivots[i] = i;
+        }
+        for (size_t k = 0; k < n; k += FACTORIZATION_BLOCK) {
+            size_t width = std::min(FACTORIZATION_BLOCK, n - k);
+            size_t next = k + width;
+            factor_panel(k, width);
+            solve_lower(lu[k] + k, n, width, lu[k] + next, n, n - next, true);
+            gemm_subtract(n - next, n - next, width, lu[next] + k, n, lu[k] + next, n, lu[next] + next, n);
+        }
+    }
+    size_t Rows() const {
+        return lu.Rows();
+    }
+    // A zero pivot was met; solve() and inverse() then throw, det() is zero.
+    bool is_singular() const {
+        return singular;
+    }
+    // The packed factors: strictly below the diagonal is L, the rest is U.
+    const Matrix<T>& factors() const {
+        return lu;
+    }
+    const std::vector<size_t>& permutation() const {
+        return pivots;
+    }
+    // X with A X = B, for every column of B at once.
+    Matrix<T> solve(const Matrix<T>& b) const {
+        check_solvable(b.Rows());
+        size_t n = lu.Rows();
+        size_t m = b.Cols();
+        Matrix<T> x(n, m);
+        for (size_t i = 0; i < n; ++i) {
+            std::copy(b[pivots[i]], b[pivots[i]] + m, x[i]);
+        }
+        solve_lower(lu.data(), n, n, x.data(), m, m, true);
+        solve_upper(lu.data(), n, n, x.data(), m, m, false);
+        return x;
+    }
+    std::vector<T> solve(const std::vector<T>& b) const {
+        check_solvable(b.size());
+        size_t n = lu.Rows();
+        std::vector<T> x(n);
+        for (size_t i = 0; i < n; ++i) {
+            x[i] = b[pivots[i]];
+        }
+        solve_lower(lu.data(), n, n, x.data(), 1, 1, true);
+        solve_upper(lu.data(), n, n, x.data(), 1, 1, false);
+        return x;
+    }
+    T det() const {
+        T result = negative ? T(-1) : T(1);
+        for (size_t i = 0; i < lu.Rows(); ++i) {
+            result *= lu(i, i);
+        }
+        return result;
+    }
+    Matrix<T> inverse() const {
+        check_solvable(lu.Rows());
+        size_t n = lu.Rows();
+        Matrix<T> x(n, n);
+        for (size_t i = 0; i < n; ++i) {
+            x(i, pivots[i]) = T(1);
+        }
+        solve_lower(lu.data(), n, n, x.data(), n, n, true);
+        solve_upper(lu.data(), n, n, x.data(), n, n, false);
+        return x;
+    }
+};
+
+// A = L L^T for a symmetric positive definite A, about half the work of LU
+// and with no pivoting. Only the lower triangle of A is read. Blocked like
+// LUDecomposition; the trailing update touches only the lower triangle,
+// one gemm per block row. The factor is stored as L with L^T mirrored into
+// the upper triangle, so solves run on contiguous rows in both directions.
+template <typename T>
+class CholeskyDecomposition {
+private:
+    Matrix<T> l;
+
+    // Unblocked factorization of the diagonal block at k.
+    void factor_diagonal(size_t k, size_t width) {
+        using std::sqrt;
+        for (size_t j = k; j < k + width; ++j) {
+            T d = l(j, j) - simd_dot(l[j] + k, l[j] + k, j - k);
+            if (!(d > T())) {
+                throw std::domain_error("matrix is not positive definite");
+            }
+            l(j, j) = sqrt(d);
+            for (size_t i = j + 1; i < k + width; ++i) {
+                l(i, j) = (l(i, j) - simd_dot(l[i] + k, l[j] + k, j - k)) / l(j, j);
+            }
+        }
+    }
+
+public:
+    explicit CholeskyDecomposition(const Matrix<T>& a) : l(a) {
+        assert(a.Rows() == a.Cols());
+        size_t n = a.Rows();
+        std::vector<T> panel_t;
+        for (size_t k = 0; k < n; k += FACTORIZATION_BLOCK) {
+            size_t width = std::min(FACTORIZATION_BLOCK, n - k);
+            size_t next = k + width;
+            factor_diagonal(k, width);
+            // L21 = A21 L11^-T: row i of L21 solves x L11^T = a_i.
+            for (size_t i = next; i < n; ++i) {
+                for (size_t j = k; j < next; ++j) {
+                    l(i, j) = (l(i, j) - simd_dot(l[i] + k, l[j] + k, j - k)) / l(j, j);
+                }
+            }
+            // A22 -= L21 L21^T, lower triangle only.
+            panel_t.resize(width * (n - next));
+            transpose_into(l[next] + k, n, panel_t.data(), n - next, n - next, width);
+            for (size_t ib = next; ib < n; ib += FACTORIZATION_BLOCK) {
+                size_t ie = std::min(n, ib + FACTORIZATION_BLOCK);
+                gemm_subtract(ie - ib, ie - next, width, l[ib] + k, n, panel_t.data(), n - next, l[ib] + next, n);
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = i + 1; j < n; ++j) {
+                l(i, j) = l(j, i);
+            }
+        }
+    }
+    size_t Rows() const {
+        return l.Rows();
+    }
+    // L, with zeros above the diagonal.
+    Matrix<T> factor() const {
+        Matrix<T> result(l);
+        for (size_t i = 0; i < result.Rows(); ++i) {
+            std::fill(result[i] + i + 1, result[i] + result.Cols(), T());
+        }
+        return result;
+    }
+    Matrix<T> solve(const Matrix<T>& b) const {
+        assert(b.Rows() == l.Rows());
+        Matrix<T> x(b);
+        size_t n = l.Rows();
+        solve_lower(l.data(), n, n, x.data(), x.Cols(), x.Cols(), false);
+        solve_upper(l.data(), n, n, x.data(), x.Cols(), x.Cols(), false);
+        return x;
+    }
+    std::vector<T> solve(const std::vector<T>& b) const {
+        assert(b.size() == l.Rows());
+        std::vector<T> x(b);
+        size_t n = l.Rows();
+        solve_lower(l.data(), n, n, x.data(), 1, 1, false);
+        solve_upper(l.data(), n, n, x.data(), 1, 1, false);
+        return x;
+    }
+    T det() const {
+        T result = T(1);
+        for (size_t i = 0; i < l.Rows(); ++i) {
+            result *= l(i, i) * l(i, i);
+        }
+        return result;
+    }
+    Matrix<T> inverse() const {
+        size_t n = l.Rows();
+        Matrix<T> x(n, n);
+        for (size_t i = 0; i < n; ++i) {
+            x(i, i) = T(1);
+        }
+        solve_lower(l.data(), n, n, x.data(), n, n, false);
+        solve_upper(l.data(), n, n, x.data(), n, n, false);
+        return x;
+    }
+};
+
+// One-off helpers; factor once with LUDecomposition to reuse the work.
+template <typename T>
+T det(const Matrix<T>& a) {
+    return LUDecomposition<T>(a).det();
+}
+
+template <typename T>
+Matrix<T> inverse(const Matrix<T>& a) {
+    return LUDecomposition<T>(a).inverse();
+}
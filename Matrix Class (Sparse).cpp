@@ -0,0 +1,217 @@
+#pragma once
+
+#include "Matrix Class.cpp"
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+enum class SparseLayout {
+    CSR,  // compressed rows: offsets per row, column index per nonzero
+    CSC   // compressed columns: offsets per column, row index per nonzero
+};
+
+// Compressed sparse matrix. Nonzeros of outer line o (a row in CSR, a
+// column in CSC) are values[offsets[o] .. offsets[o + 1]), with their inner
+// indices, sorted, in the same positions of indices. Memory is
+// O(nonzeros + outer lines), and products touch only the stored entries.
+template <typename T>
+class SparseMatrix {
+public:
+    struct Triplet {
+        size_t row;
+        size_t col;
+        T value;
+    };
+
+private:
+    SparseLayout _layout = SparseLayout::CSR;
+    size_t _rows = 0;
+    size_t _cols = 0;
+    std::vector<size_t> _offsets;
+    std::vector<size_t> _indices;
+    std::vector<T> _values;
+
+    // Rows of the product handed to one task.
+    static constexpr size_t PARALLEL_ROWS = 256;
+
+    size_t outer_size() const {
+        return _layout == SparseLayout::CSR ? _rows : _cols;
+    }
+
+public:
+    SparseMatrix() : _offsets(1, 0) {
+    }
+    SparseMatrix(size_t rows, size_t cols, SparseLayout layout = SparseLayout::CSR)
+        : _layout(layout), _rows(rows), _cols(cols),
+          _offsets((layout == SparseLayout::CSR ? rows : cols) + 1, 0) {
+    }
+    // Keeps every element that is not equal to zero.
+    explicit SparseMatrix(const Matrix<T>& dense, SparseLayout layout = SparseLayout::CSR, const T& zero = T())
+        : SparseMatrix(dense.Rows(), dense.Cols(), layout) {
+        size_t outer = outer_size();
+        size_t inner = layout == SparseLayout::CSR ? _cols : _rows;
+        for (size_t o = 0; o < outer; ++o) {
+            for (size_t i = 0; i < inner; ++i) {
+                const T& value = layout == SparseLayout::CSR ? dense(o, i) : dense(i, o);
+                if (!(value == zero)) {
+                    _indices.push_back(i);
+                    _values.push_back(value);
+                }
+            }
+            _offsets[o + 1] = _values.size();
+        }
+    }
+    // Builds from (row, col, value) entries in any order; duplicates are summed.
+    static SparseMatrix from_triplets(size_t rows, size_t cols, std::vector<Triplet> triplets,
+                                      SparseLayout layout = SparseLayout::CSR) {
+        SparseMatrix result(rows, cols, layout);
+        bool csr = layout == SparseLayout::CSR;
+        std::sort(triplets.begin(), triplets.end(), [csr](const Triplet& a, const Triplet& b) {
+            return csr ? std::make_pair(a.row, a.col) < std::make_pair(b.row, b.col)
+                       : std::make_pair(a.col, a.row) < std::make_pair(b.col, b.row);
+        });
+        for (size_t t = 0; t < triplets.size(); ++t) {
+            const Triplet& entry = triplets[t];
+            assert(entry.row < rows && entry.col < cols);
+            size_t outer = csr ? entry.row : entry.col;
+            size_t inner = csr ? entry.col : entry.row;
+            if (t > 0 && triplets[t - 1].row == entry.row && triplets[t - 1].col == entry.col) {
+                result._values.back() += entry.value;
+                continue;
+            }
+            result._indices.push_back(inner);
+            result._values.push_back(entry.value);
+            ++result._offsets[outer + 1];
+        }
+        for (size_t o = 0; o < result.outer_size(); ++o) {
+            result._offsets[o + 1] += result._offsets[o];
+        }
+        return result;
+    }
+    size_t Rows() const noexcept {
+        return _rows;
+    }
+    size_t Cols() const noexcept {
+        return _cols;
+    }
+    size_t nonzeros() const noexcept {
+        return _values.size();
+    }
+    SparseLayout layout() const noexcept {
+        return _layout;
+    }
+    const std::vector<size_t>& offsets() const noexcept {
+        return _offsets;
+    }
+    const std::vector<size_t>& indices() const noexcept {
+        return _indices;
+    }
+    const std::vector<T>& values() const noexcept {
+        return _values;
+    }
+    // Binary search in the element's outer line; T() when it is not stored.
+    T operator()(size_t i, size_t j) const {
+        size_t outer = _layout == SparseLayout::CSR ? i : j;
+        size_t inner = _layout == SparseLayout::CSR ? j : i;
+        auto first = _indices.begin() + _offsets[outer];
+        auto last = _indices.begin() + _offsets[outer + 1];
+        auto it = std::lower_bound(first, last, inner);
+        if (it == last || *it != inner) {
+            return T();
+        }
+        return _values[it - _indices.begin()];
+    }
+    // Same matrix in the other compression, by a counting sort on the
+    // inner index: O(nonzeros + rows + cols).
+    SparseMatrix to_layout(SparseLayout layout) const {
+        if (layout == _layout) {
+            return *this;
+        }
+        SparseMatrix result(_rows, _cols, layout);
+        size_t outer = outer_size();
+        for (size_t idx : _indices) {
+            ++result._offsets[idx + 1];
+        }
+        for (size_t o = 0; o < result.outer_size(); ++o) {
+            result._offsets[o + 1] += result._offsets[o];
+        }
+        result._indices.resize(nonzeros());
+        result._values.resize(nonzeros());
+        std::vector<size_t> next(result._offsets.begin(), result._offsets.end() - 1);
+        for (size_t o = 0; o < outer; ++o) {
+            for (size_t p = _offsets[o]; p < _offsets[o + 1]; ++p) {
+                size_t dst = next[_indices[p]]++;
+                result._indices[dst] = o;
+                result._values[dst] = _values[p];
+            }
+        }
+        return result;
+    }
+    // The CSR arrays of A are the CSC arrays of A^T, so transposing only
+    // swaps the shape and the layout tag; call to_layout() afterwards to
+    // get the original compression back.
+    SparseMatrix transposed() const {
+        SparseMatrix result = *this;
+        std::swap(result._rows, result._cols);
+        result._layout = _layout == SparseLayout::CSR ? SparseLayout::CSC : SparseLayout::CSR;
+        return result;
+    }
+    Matrix<T> to_dense() const {
+        Matrix<T> dense(_rows, _cols);
+        for (size_t o = 0; o < outer_size(); ++o) {
+            for (size_t p = _offsets[o]; p < _offsets[o + 1]; ++p) {
+                if (_layout == SparseLayout::CSR) {
+                    dense(o, _indices[p]) = _values[p];
+                } else {
+                    dense(_indices[p], o) = _values[p];
+                }
+            }
+        }
+        return dense;
+    }
+    // SpMV. CSR computes each output as an independent row dot product, in
+    // parallel; CSC scatters column by column on the calling thread.
+    std::vector<T> operator*(const std::vector<T>& x) const {
+        assert(x.size() == _cols);
+        std::vector<T> y(_rows, T());
+        if (_layout == SparseLayout::CSR) {
+            ThreadPool::global().parallel_for(_rows, PARALLEL_ROWS, [this, &x, &y](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    T sum = T();
+                    for (size_t p = _offsets[i]; p < _offsets[i + 1]; ++p) {
+                        sum += _values[p] * x[_indices[p]];
+                    }
+                    y[i] = sum;
+                }
+            });
+        } else {
+            for (size_t j = 0; j < _cols; ++j) {
+                for (size_t p = _offsets[j]; p < _offsets[j + 1]; ++p) {
+                    y[_indices[p]] += _values[p] * x[j];
+                }
+            }
+        }
+        return y;
+    }
+    // SpMM against a dense matrix: row i of the result is the sum of
+    // value * (row k of dense) over the nonzeros (i, k), each an axpy on
+    // contiguous rows. CSC operands are converted to CSR first so rows of
+    // the result can be computed in parallel.
+    Matrix<T> operator*(const Matrix<T>& dense) const {
+        assert(_cols == dense.Rows());
+        if (_layout == SparseLayout::CSC) {
+            return to_layout(SparseLayout::CSR) * dense;
+        }
+        Matrix<T> result(_rows, dense.Cols());
+        size_t n = dense.Cols();
+        ThreadPool::global().parallel_for(_rows, PARALLEL_ROWS, [this, &dense, &result, n](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                for (size_t p = _offsets[i]; p < _offsets[i + 1]; ++p) {
+                    simd_zip(result[i], dense[_indices[p]], n, SimdAxpy<T>{_values[p]});
+                }
+            }
+        });
+        return result;
+    }
+};
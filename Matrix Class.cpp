@@ -1,146 +1,1803 @@
+#pragma once
+
 #include <iostream>
 #include <vector>
 #include <cassert>
+#include <cmath>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "ThreadPool.cpp"
 
+// Non-owning window onto row-major storage: element (i, j) lives at
+// data[i * stride + j]. Rows, columns and submatrices of a Matrix are all
+// views of this kind, so taking one never copies.
 template <typename T>
-class Matrix {
+class MatrixView {
 private:
-    std::vector<std::vector<T>> mat;
-    size_t rows = mat.size();
-    size_t cols = mat[0].size();
-    std::vector<T> vecmat;
+    T* _data = nullptr;
+    size_t _rows = 0;
+    size_t _cols = 0;
+    size_t _stride = 0;
 
 public:
-    Matrix(const std::vector<std::vector<T>>& matrix) : mat(matrix) {
-        for (auto& v : mat) {
-            for (T el : v) {
-                vecmat.push_back(el);
-            }
-        }
+    MatrixView() = default;
+    MatrixView(T* data, size_t rows, size_t cols, size_t stride)
+        : _data(data), _rows(rows), _cols(cols), _stride(stride) {
+    }
+    template <typename U, typename = std::enable_if_t<std::is_same<const U, T>::value>>
+    MatrixView(const MatrixView<U>& other)
+        : _data(other.data()), _rows(other.Rows()), _cols(other.Cols()), _stride(other.Stride()) {
     }
     size_t Rows() const noexcept {
-        return mat.size();
+        return _rows;
     }
     size_t Cols() const noexcept {
-        return mat[0].size();
+        return _cols;
     }
-    std::vector<T> operator[] (size_t i) const {
-        return mat[i];
+    size_t Stride() const noexcept {
+        return _stride;
     }
-    std::vector<T>& operator[] (size_t i) {
-        return mat[i];
+    T* data() const noexcept {
+        return _data;
     }
-    std::pair<size_t, size_t> size() const {
-        return std::make_pair(mat.size(), mat[0].size());
+    T* operator[] (size_t i) const {
+        return _data + i * _stride;
+    }
+    T& operator()(size_t i, size_t j) const {
+        return _data[i * _stride + j];
+    }
+    MatrixView row(size_t i) const {
+        assert(i < _rows);
+        return MatrixView(_data + i * _stride, 1, _cols, _stride);
+    }
+    MatrixView col(size_t j) const {
+        assert(j < _cols);
+        return MatrixView(_data + j, _rows, 1, _stride);
+    }
+    MatrixView submatrix(size_t row, size_t col, size_t rows, size_t cols) const {
+        assert(row + rows <= _rows && col + cols <= _cols);
+        return MatrixView(_data + row * _stride + col, rows, cols, _stride);
+    }
+};
+
+// Packed, cache-blocked GEMM in the Goto/BLIS layout. A KC x NC panel of B
+// is packed to stay in L2/L3, an MC x KC block of A is packed to stay in L2,
+// and an MR x NR micro-kernel keeps its whole tile of C in registers while
+// it streams both packed operands. Edge tiles are zero-padded when packed,
+// so the micro-kernel never branches on the size.
+#if defined(__AVX512F__)
+constexpr size_t GEMM_VECTOR_BYTES = 64;
+constexpr size_t GEMM_MR = 6;
+#elif defined(__AVX__)
+constexpr size_t GEMM_VECTOR_BYTES = 32;
+constexpr size_t GEMM_MR = 6;
+#else
+constexpr size_t GEMM_VECTOR_BYTES = 16;
+constexpr size_t GEMM_MR = 4;
+#endif
+
+template <typename T>
+struct GemmKernel {
+    static constexpr size_t LANES = GEMM_VECTOR_BYTES / sizeof(T);
+    static constexpr size_t MR = GEMM_MR;
+    static constexpr size_t NR = 2 * LANES;
+    static constexpr size_t KC = 256;
+    static constexpr size_t MC = 20 * MR;
+    static constexpr size_t NC = 2048;
+    // Products smaller than this many multiply-adds stay on the calling thread.
+    static constexpr size_t PARALLEL_FLOPS = size_t(1) << 21;
+
+    // kc x nc block of B into NR-wide slivers, each stored k-major.
+    static void pack_b(size_t kc, size_t nc, const T* b, size_t ldb, T* out) {
+        for (size_t j = 0; j < nc; j += NR) {
+            size_t nr = std::min(NR, nc - j);
+            for (size_t p = 0; p < kc; ++p) {
+                const T* src = b + p * ldb + j;
+                size_t x = 0;
+                for (; x < nr; ++x) {
+                    out[x] = src[x];
+                }
+                for (; x < NR; ++x) {
+                    out[x] = T();
+                }
+                out += NR;
+            }
+        }
+    }
+
+    // mc x kc block of A into MR-tall slivers, each stored k-major.
+    static void pack_a(size_t mc, size_t kc, const T* a, size_t lda, T* out) {
+        for (size_t i = 0; i < mc; i += MR) {
+            size_t mr = std::min(MR, mc - i);
+            for (size_t p = 0; p < kc; ++p) {
+                size_t x = 0;
+                for (; x < mr; ++x) {
+                    out[x] = a[(i + x) * lda + p];
+                }
+                for (; x < MR; ++x) {
+                    out[x] = T();
+                }
+                out += MR;
+            }
+        }
+    }
+
+#if defined(__GNUC__)
+    typedef T Vec __attribute__((vector_size(GEMM_VECTOR_BYTES)));
+
+    // C[mr x nr] += A sliver * B sliver, accumulated in 2 * MR vector registers.
+    static void micro_kernel(size_t kc, const T* a, const T* b, T* c, size_t ldc, size_t mr, size_t nr) {
+        Vec acc[MR][2] = {};
+        for (size_t p = 0; p < kc; ++p) {
+            Vec b0, b1;
+            std::memcpy(&b0, b, sizeof(Vec));
+            std::memcpy(&b1, b + LANES, sizeof(Vec));
+            for (size_t i = 0; i < MR; ++i) {
+                const T ai = a[i];
+                acc[i][0] += ai * b0;
+                acc[i][1] += ai * b1;
+            }
+            a += MR;
+            b += NR;
+        }
+        for (size_t i = 0; i < mr; ++i) {
+            T tile[NR];
+            std::memcpy(tile, acc[i], sizeof(tile));
+            for (size_t j = 0; j < nr; ++j) {
+                c[i * ldc + j] += tile[j];
+            }
+        }
+    }
+#else
+    static void micro_kernel(size_t kc, const T* a, const T* b, T* c, size_t ldc, size_t mr, size_t nr) {
+        T acc[MR][NR] = {};
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i = 0; i < MR; ++i) {
+                const T ai = a[i];
+                for (size_t j = 0; j < NR; ++j) {
+                    acc[i][j] += ai * b[j];
+                }
+            }
+            a += MR;
+            b += NR;
+        }
+        for (size_t i = 0; i < mr; ++i) {
+            for (size_t j = 0; j < nr; ++j) {
+                c[i * ldc + j] += acc[i][j];
+            }
+        }
+    }
+#endif
+
+    // Every packed A block against the packed B panel at (pc, jc).
+    static void macro_kernel(size_t mc, size_t nc, size_t kc, const T* a_packed, const T* b_packed,
+                             T* c, size_t ldc) {
+        for (size_t j = 0; j < nc; j += NR) {
+            size_t nr = std::min(NR, nc - j);
+            for (size_t i = 0; i < mc; i += MR) {
+                size_t mr = std::min(MR, mc - i);
+                micro_kernel(kc, a_packed + i * kc, b_packed + j * kc, c + i * ldc + j, ldc, mr, nr);
+            }
+        }
+    }
+
+    // The packed B panel is shared; each task packs its own A block and
+    // owns a disjoint tile of C, so every element of C sees the same sums
+    // in the same order whatever the thread count.
+    static void run(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb,
+                    T* c, size_t ldc) {
+        ThreadPool& pool = ThreadPool::global();
+        bool parallel = pool.size() > 1 && m * n * k >= PARALLEL_FLOPS;
+        // Packing buffers are sized to the problem, so small products stay cheap.
+        size_t kc_max = std::min(KC, k);
+        std::vector<T> b_packed(kc_max * ((std::min(NC, n) + NR - 1) / NR * NR));
+        for (size_t jc = 0; jc < n; jc += NC) {
+            size_t nc = std::min(NC, n - jc);
+            size_t slivers = (nc + NR - 1) / NR;
+            size_t m_blocks = (m + MC - 1) / MC;
+            // Split columns too when there are fewer row blocks than threads.
+            size_t n_parts = parallel ? std::min(slivers, (pool.size() + m_blocks - 1) / m_blocks) : 1;
+            size_t part_slivers = (slivers + n_parts - 1) / n_parts;
+            for (size_t pc = 0; pc < k; pc += KC) {
+                size_t kc = std::min(KC, k - pc);
+                if (parallel) {
+                    pool.parallel_for(slivers, 1, [&](size_t begin, size_t end) {
+                        size_t j = begin * NR;
+                        pack_b(kc, std::min(nc, end * NR) - j, b + pc * ldb + jc + j, ldb, b_packed.data() + j * kc);
+                    });
+                } else {
+                    pack_b(kc, nc, b + pc * ldb + jc, ldb, b_packed.data());
+                }
+                auto tiles = [&](size_t begin, size_t end) {
+                    std::vector<T> a_packed(((std::min(MC, m) + MR - 1) / MR * MR) * kc);
+                    for (size_t t = begin; t < end; ++t) {
+                        size_t ic = (t / n_parts) * MC;
+                        size_t mc = std::min(MC, m - ic);
+                        size_t j = (t % n_parts) * part_slivers * NR;
+                        if (j >= nc) {
+                            continue;
+                        }
+                        size_t width = std::min(part_slivers * NR, nc - j);
+                        pack_a(mc, kc, a + ic * lda + pc, lda, a_packed.data());
+                        macro_kernel(mc, width, kc, a_packed.data(), b_packed.data() + j * kc,
+                                     c + ic * ldc + jc + j, ldc);
+                    }
+                };
+                if (parallel) {
+                    pool.parallel_for(m_blocks * n_parts, 1, tiles);
+                } else {
+                    tiles(0, m_blocks * n_parts);
+                }
+            }
+        }
+    }
+};
+
+// Built-in arithmetic types go through the packed and vector kernels;
+// anything else (Rational, Complex, long double, ...) uses plain loops.
+template <typename T>
+struct UseVectorKernels : std::integral_constant<bool, std::is_arithmetic<T>::value &&
+        !std::is_same<T, bool>::value && sizeof(T) <= 8> {
+};
+
+// C[m x n] += A[m x k] * B[k x n] with the classical O(mnk) kernels.
+template <typename T>
+void gemm_blocked(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc) {
+    if (m == 0 || n == 0 || k == 0) {
+        return;
     }
-    Matrix& operator=(const Matrix& rhs) {
+    if constexpr (UseVectorKernels<T>::value) {
+        GemmKernel<T>::run(m, n, k, a, lda, b, ldb, c, ldc);
+    } else {
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t p = 0; p < k; ++p) {
+                const T aip = a[i * lda + p];
+                for (size_t j = 0; j < n; ++j) {
+                    c[i * ldc + j] += aip * b[p * ldb + j];
+                }
+            }
+        }
+    }
+}
+
+// Square products of at least this order use Strassen-Winograd; 0 turns it
+// off. It is on by default only for integral types, where the reordered
+// sums are exact; for floating point it trades accuracy for speed.
+template <typename T>
+size_t& strassen_threshold_slot() {
+    static size_t threshold = std::is_integral<T>::value && UseVectorKernels<T>::value ? 512 : 0;
+    return threshold;
+}
+
+template <typename T>
+size_t strassen_threshold() {
+    return strassen_threshold_slot<T>();
+}
+
+template <typename T>
+void set_strassen_threshold(size_t threshold) {
+    strassen_threshold_slot<T>() = threshold;
+}
+
+template <typename T>
+void fill_block(T* c, size_t ldc, size_t rows, size_t cols, const T& value) {
+    for (size_t i = 0; i < rows; ++i) {
+        std::fill(c + i * ldc, c + i * ldc + cols, value);
+    }
+}
+
+// dst = a + sign * b over an n x n block; dst may alias a or b.
+template <typename T>
+void combine_block(T* dst, size_t ldd, const T* a, size_t lda, const T* b, size_t ldb, size_t n, bool subtract) {
+    for (size_t i = 0; i < n; ++i) {
+        T* d = dst + i * ldd;
+        const T* x = a + i * lda;
+        const T* y = b + i * ldb;
+        if (subtract) {
+            for (size_t j = 0; j < n; ++j) {
+                d[j] = x[j] - y[j];
+            }
+        } else {
+            for (size_t j = 0; j < n; ++j) {
+                d[j] = x[j] + y[j];
+            }
+        }
+    }
+}
+
+// C = A * B for n x n operands (C is overwritten), by the Winograd form of
+// Strassen's algorithm: 7 half-size products and 15 additions per level.
+// The schedule is the two-temporary one of Douglas et al.: the quadrants
+// of C hold intermediate products, so each level needs only X (an A-sized
+// half block) and Y (a B-sized one). An odd order is handled by peeling
+// the last row and column off and fixing them up with the blocked kernel.
+template <typename T>
+void strassen_winograd(size_t n, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc) {
+    size_t threshold = strassen_threshold<T>();
+    if (threshold == 0 || n < std::max<size_t>(threshold, 2)) {
+        fill_block(c, ldc, n, n, T());
+        gemm_blocked(n, n, n, a, lda, b, ldb, c, ldc);
+        return;
+    }
+    if (n % 2 != 0) {
+        size_t e = n - 1;
+        strassen_winograd(e, a, lda, b, ldb, c, ldc);
+        // C11 += a12 * b21, then the last column and the last row in full.
+        gemm_blocked(e, e, 1, a + e, lda, b + e * ldb, ldb, c, ldc);
+        fill_block(c + e, ldc, n, 1, T());
+        gemm_blocked(n, 1, n, a, lda, b + e, ldb, c + e, ldc);
+        fill_block(c + e * ldc, ldc, 1, e, T());
+        gemm_blocked(1, e, n, a + e * lda, lda, b, ldb, c + e * ldc, ldc);
+        return;
+    }
+    size_t h = n / 2;
+    const T* a11 = a;
+    const T* a12 = a + h;
+    const T* a21 = a + h * lda;
+    const T* a22 = a + h * lda + h;
+    const T* b11 = b;
+    const T* b12 = b + h;
+    const T* b21 = b + h * ldb;
+    const T* b22 = b + h * ldb + h;
+    T* c11 = c;
+    T* c12 = c + h;
+    T* c21 = c + h * ldc;
+    T* c22 = c + h * ldc + h;
+    std::vector<T> x_buffer(h * h);
+    std::vector<T> y_buffer(h * h);
+    T* x = x_buffer.data();
+    T* y = y_buffer.data();
+
+    combine_block(x, h, a11, lda, a21, lda, h, true);       // S3 = A11 - A21
+    combine_block(y, h, b22, ldb, b12, ldb, h, true);       // T3 = B22 - B12
+    strassen_winograd(h, x, h, y, h, c21, ldc);             // P7 = S3 * T3
+    combine_block(x, h, a21, lda, a22, lda, h, false);      // S1 = A21 + A22
+    combine_block(y, h, b12, ldb, b11, ldb, h, true);       // T1 = B12 - B11
+    strassen_winograd(h, x, h, y, h, c22, ldc);             // P5 = S1 * T1
+    combine_block(y, h, b22, ldb, y, h, h, true);           // T2 = B22 - T1
+    combine_block(x, h, x, h, a11, lda, h, true);           // S2 = S1 - A11
+    strassen_winograd(h, x, h, y, h, c12, ldc);             // P6 = S2 * T2
+    combine_block(x, h, a12, lda, x, h, h, true);           // S4 = A12 - S2
+    strassen_winograd(h, x, h, b22, ldb, c11, ldc);         // P3 = S4 * B22
+    strassen_winograd(h, a11, lda, b11, ldb, x, h);         // P1 = A11 * B11
+    combine_block(c12, ldc, x, h, c12, ldc, h, false);      // U2 = P1 + P6
+    combine_block(c21, ldc, c12, ldc, c21, ldc, h, false);  // U3 = U2 + P7
+    combine_block(c12, ldc, c12, ldc, c22, ldc, h, false);  // U4 = U2 + P5
+    combine_block(c22, ldc, c21, ldc, c22, ldc, h, false);  // U7 = U3 + P5 = C22
+    combine_block(c12, ldc, c12, ldc, c11, ldc, h, false);  // U5 = U4 + P3 = C12
+    combine_block(y, h, y, h, b21, ldb, h, true);           // T4 = T2 - B21
+    strassen_winograd(h, a22, lda, y, h, c11, ldc);         // P4 = A22 * T4
+    combine_block(c21, ldc, c21, ldc, c11, ldc, h, true);   // U6 = U3 - P4 = C21
+    strassen_winograd(h, a12, lda, b21, ldb, c11, ldc);     // P2 = A12 * B21
+    combine_block(c11, ldc, x, h, c11, ldc, h, false);      // U1 = P1 + P2 = C11
+}
+
+// C[m x n] += A[m x k] * B[k x n]; all three are row-major with leading
+// dimensions lda, ldb and ldc, so they may be views into larger matrices.
+// With accumulate false, C is overwritten and its old contents are ignored.
+// Square products at or above strassen_threshold<T>() use Strassen-Winograd.
+template <typename T>
+void gemm(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc,
+          bool accumulate = true) {
+    size_t threshold = strassen_threshold<T>();
+    if (m == n && n == k && threshold != 0 && n >= threshold) {
+        if (!accumulate) {
+            strassen_winograd(n, a, lda, b, ldb, c, ldc);
+            return;
+        }
+        std::vector<T> product(n * n);
+        strassen_winograd(n, a, lda, b, ldb, product.data(), n);
+        combine_block(c, ldc, c, ldc, product.data(), n, n, false);
+        return;
+    }
+    if (!accumulate) {
+        fill_block(c, ldc, m, n, T());
+    }
+    gemm_blocked(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+// Elementwise kernels over contiguous arrays. Each one is written once over
+// GCC vector extensions and compiled for several widths; simd_level() picks
+// the widest the running CPU supports, so one binary uses AVX-512 or AVX2
+// where available without requiring them. Other element types and other
+// compilers take the scalar loops.
+enum class SimdLevel {
+    SCALAR,
+    VECTOR128,
+    AVX2,
+    AVX512
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_SIMD_DISPATCH 1
+#endif
+
+inline SimdLevel detect_simd_level() {
+#if defined(MATRIX_SIMD_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::VECTOR128;
+    }
+    return SimdLevel::SCALAR;
+#elif defined(__GNUC__)
+    return SimdLevel::VECTOR128;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+inline SimdLevel& simd_level_slot() {
+    static SimdLevel level = detect_simd_level();
+    return level;
+}
+
+inline SimdLevel simd_level() {
+    return simd_level_slot();
+}
+
+// Caps the kernels at a lower level (e.g. SCALAR to compare against the
+// fallback); levels above what the CPU supports are ignored.
+inline void set_simd_level(SimdLevel level) {
+    simd_level_slot() = std::min(level, detect_simd_level());
+}
+
+// Operations update their first argument in place, so they never pass a
+// vector by value across an ABI boundary.
+struct SimdAdd {
+    template <typename V>
+    void operator()(V& a, const V& b) const {
+        a += b;
+    }
+};
+
+struct SimdSub {
+    template <typename V>
+    void operator()(V& a, const V& b) const {
+        a -= b;
+    }
+};
+
+struct SimdMul {
+    template <typename V>
+    void operator()(V& a, const V& b) const {
+        a *= b;
+    }
+};
+
+struct SimdMin {
+    template <typename V>
+    void operator()(V& a, const V& b) const {
+        a = b < a ? b : a;
+    }
+};
+
+struct SimdMax {
+    template <typename V>
+    void operator()(V& a, const V& b) const {
+        a = a < b ? b : a;
+    }
+};
+
+template <typename T>
+struct SimdAxpy {
+    T alpha;
+    template <typename V>
+    void operator()(V& a, const V& b) const {
+        a += alpha * b;
+    }
+};
+
+template <typename T>
+struct SimdScale {
+    T scalar;
+    template <typename V>
+    void operator()(V& a) const {
+        a *= scalar;
+    }
+};
+
+#if defined(__GNUC__)
+// dst[i] = op(dst[i], src[i])
+template <size_t BYTES, typename T, typename Op>
+__attribute__((always_inline)) inline void simd_zip_kernel(T* dst, const T* src, size_t n, Op op) {
+    typedef T Vec __attribute__((vector_size(BYTES)));
+    constexpr size_t LANES = BYTES / sizeof(T);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        Vec a, b;
+        std::memcpy(&a, dst + i, BYTES);
+        std::memcpy(&b, src + i, BYTES);
+        op(a, b);
+        std::memcpy(dst + i, &a, BYTES);
+    }
+    for (; i < n; ++i) {
+        op(dst[i], src[i]);
+    }
+}
+
+// dst[i] = op(dst[i])
+template <size_t BYTES, typename T, typename Op>
+__attribute__((always_inline)) inline void simd_map_kernel(T* dst, size_t n, Op op) {
+    typedef T Vec __attribute__((vector_size(BYTES)));
+    constexpr size_t LANES = BYTES / sizeof(T);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        Vec a;
+        std::memcpy(&a, dst + i, BYTES);
+        op(a);
+        std::memcpy(dst + i, &a, BYTES);
+    }
+    for (; i < n; ++i) {
+        op(dst[i]);
+    }
+}
+
+// Sum of a[i] * b[i], or of a[i] when b is null, over two accumulators.
+template <size_t BYTES, typename T>
+__attribute__((always_inline)) inline T simd_dot_kernel(const T* a, const T* b, size_t n) {
+    typedef T Vec __attribute__((vector_size(BYTES)));
+    constexpr size_t LANES = BYTES / sizeof(T);
+    Vec acc0 = {};
+    Vec acc1 = {};
+    size_t i = 0;
+    for (; i + 2 * LANES <= n; i += 2 * LANES) {
+        Vec x0, x1;
+        std::memcpy(&x0, a + i, BYTES);
+        std::memcpy(&x1, a + i + LANES, BYTES);
+        if (b != nullptr) {
+            Vec y0, y1;
+            std::memcpy(&y0, b + i, BYTES);
+            std::memcpy(&y1, b + i + LANES, BYTES);
+            x0 *= y0;
+            x1 *= y1;
+        }
+        acc0 += x0;
+        acc1 += x1;
+    }
+    acc0 += acc1;
+    T lanes[LANES];
+    std::memcpy(lanes, &acc0, BYTES);
+    T total = T();
+    for (size_t l = 0; l < LANES; ++l) {
+        total += lanes[l];
+    }
+    for (; i < n; ++i) {
+        total += b != nullptr ? a[i] * b[i] : a[i];
+    }
+    return total;
+}
+#endif
+
+#if defined(MATRIX_SIMD_DISPATCH)
+#define MATRIX_SIMD_VARIANTS(suffix, isa, bytes) \
+template <typename T, typename Op> \
+__attribute__((target(isa))) void simd_zip_##suffix(T* dst, const T* src, size_t n, Op op) { \
+    simd_zip_kernel<bytes>(dst, src, n, op); \
+} \
+template <typename T, typename Op> \
+__attribute__((target(isa))) void simd_map_##suffix(T* dst, size_t n, Op op) { \
+    simd_map_kernel<bytes>(dst, n, op); \
+} \
+template <typename T> \
+__attribute__((target(isa))) T simd_dot_##suffix(const T* a, const T* b, size_t n) { \
+    return simd_dot_kernel<bytes>(a, b, n); \
+}
+
+MATRIX_SIMD_VARIANTS(avx512, "avx512f", 64)
+MATRIX_SIMD_VARIANTS(avx2, "avx2", 32)
+#undef MATRIX_SIMD_VARIANTS
+#endif
+
+template <typename T, typename Op>
+void simd_zip(T* dst, const T* src, size_t n, Op op) {
+    if constexpr (UseVectorKernels<T>::value) {
+        switch (simd_level()) {
+#if defined(MATRIX_SIMD_DISPATCH)
+            case SimdLevel::AVX512:
+                return simd_zip_avx512(dst, src, n, op);
+            case SimdLevel::AVX2:
+                return simd_zip_avx2(dst, src, n, op);
+#endif
+#if defined(__GNUC__)
+            case SimdLevel::VECTOR128:
+                return simd_zip_kernel<16>(dst, src, n, op);
+#endif
+            default:
+                break;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        op(dst[i], src[i]);
+    }
+}
+
+template <typename T, typename Op>
+void simd_map(T* dst, size_t n, Op op) {
+    if constexpr (UseVectorKernels<T>::value) {
+        switch (simd_level()) {
+#if defined(MATRIX_SIMD_DISPATCH)
+            case SimdLevel::AVX512:
+                return simd_map_avx512(dst, n, op);
+            case SimdLevel::AVX2:
+                return simd_map_avx2(dst, n, op);
+#endif
+#if defined(__GNUC__)
+            case SimdLevel::VECTOR128:
+                return simd_map_kernel<16>(dst, n, op);
+#endif
+            default:
+                break;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        op(dst[i]);
+    }
+}
+
+// Sum of a[i] * b[i]; sum of a[i] when b is null. The association of the
+// sum depends on the vector width, so float results can differ by level.
+template <typename T>
+T simd_dot(const T* a, const T* b, size_t n) {
+    if constexpr (UseVectorKernels<T>::value) {
+        switch (simd_level()) {
+#if defined(MATRIX_SIMD_DISPATCH)
+            case SimdLevel::AVX512:
+                return simd_dot_avx512(a, b, n);
+            case SimdLevel::AVX2:
+                return simd_dot_avx2(a, b, n);
+#endif
+#if defined(__GNUC__)
+            case SimdLevel::VECTOR128:
+                return simd_dot_kernel<16>(a, b, n);
+#endif
+            default:
+                break;
+        }
+    }
+    T total = T();
+    for (size_t i = 0; i < n; ++i) {
+        total += b != nullptr ? a[i] * b[i] : a[i];
+    }
+    return total;
+}
+
+// Below this many rows and columns a transpose block is done with plain
+// loops; both the source and destination tiles then sit in L1.
+constexpr size_t TRANSPOSE_LEAF = 32;
+
+// out (cols x rows, leading dimension ldo) = transpose of in (rows x cols,
+// leading dimension ldi). Cache-oblivious: the longer side is halved until
+// the block fits the leaf, so every cache level sees blocks that fit it.
+template <typename T>
+void transpose_into(const T* in, size_t ldi, T* out, size_t ldo, size_t rows, size_t cols) {
+    if (rows <= TRANSPOSE_LEAF && cols <= TRANSPOSE_LEAF) {
         for (size_t i = 0; i < rows; ++i) {
             for (size_t j = 0; j < cols; ++j) {
-                mat[i][j] = rhs[i][j];
+                out[j * ldo + i] = in[i * ldi + j];
             }
         }
-        return *this;
+    } else if (rows >= cols) {
+        size_t half = rows / 2;
+        transpose_into(in, ldi, out, ldo, half, cols);
+        transpose_into(in + half * ldi, ldi, out + half, ldo, rows - half, cols);
+    } else {
+        size_t half = cols / 2;
+        transpose_into(in, ldi, out, ldo, rows, half);
+        transpose_into(in + half, ldi, out + half * ldo, ldo, rows, cols - half);
     }
-    Matrix& operator+=(const Matrix& rhs) {
+}
+
+// Swaps the rows x cols block at a with the transpose of the cols x rows
+// block at b, both inside the same matrix of leading dimension ld.
+template <typename T>
+void transpose_swap(T* a, T* b, size_t ld, size_t rows, size_t cols) {
+    if (rows <= TRANSPOSE_LEAF && cols <= TRANSPOSE_LEAF) {
         for (size_t i = 0; i < rows; ++i) {
             for (size_t j = 0; j < cols; ++j) {
-                mat[i][j] += rhs[i][j];
+                std::swap(a[i * ld + j], b[j * ld + i]);
             }
         }
+    } else if (rows >= cols) {
+        size_t half = rows / 2;
+        transpose_swap(a, b, ld, half, cols);
+        transpose_swap(a + half * ld, b + half, ld, rows - half, cols);
+    } else {
+        size_t half = cols / 2;
+        transpose_swap(a, b, ld, rows, half);
+        transpose_swap(a + half, b + half * ld, ld, rows, cols - half);
+    }
+}
+
+// In-place transpose of the n x n block at a: transpose both diagonal
+// quarters, then swap the off-diagonal ones.
+template <typename T>
+void transpose_square(T* a, size_t ld, size_t n) {
+    if (n <= TRANSPOSE_LEAF) {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = i + 1; j < n; ++j) {
+                std::swap(a[i * ld + j], a[j * ld + i]);
+            }
+        }
+        return;
+    }
+    size_t half = n / 2;
+    transpose_square(a, ld, half);
+    transpose_square(a + half * ld + half, ld, n - half);
+    transpose_swap(a + half, a + half * ld, ld, half, n - half);
+}
+
+// In-place transpose of a non-square rows x cols buffer by following the
+// permutation's cycles: the element at index k belongs at k * rows mod
+// (rows * cols - 1). Costs one bit per element to mark finished slots.
+template <typename T>
+void transpose_cycles(T* a, size_t rows, size_t cols) {
+    size_t n = rows * cols;
+    if (rows <= 1 || cols <= 1) {
+        return;
+    }
+    std::vector<bool> moved(n);
+    for (size_t start = 1; start + 1 < n; ++start) {
+        if (moved[start]) {
+            continue;
+        }
+        T value = std::move(a[start]);
+        size_t k = start;
+        do {
+            k = k * rows % (n - 1);
+            std::swap(value, a[k]);
+            moved[k] = true;
+        } while (k != start);
+    }
+}
+
+// Element encodings recorded in a binary Matrix file. OPAQUE covers any
+// other trivially copyable type, matched on size alone.
+enum class MatrixElementKind : uint32_t {
+    OPAQUE = 0,
+    SIGNED = 1,
+    UNSIGNED = 2,
+    FLOAT = 3
+};
+
+template <typename T>
+constexpr MatrixElementKind matrix_element_kind() {
+    if constexpr (std::is_floating_point<T>::value) {
+        return MatrixElementKind::FLOAT;
+    } else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value) {
+        return MatrixElementKind::SIGNED;
+    } else if constexpr (std::is_integral<T>::value) {
+        return MatrixElementKind::UNSIGNED;
+    } else {
+        return MatrixElementKind::OPAQUE;
+    }
+}
+
+// Leading 64 bytes of a binary Matrix file. The elements follow at
+// data_offset (64-byte aligned) as rows * cols values in row-major order,
+// in the writer's byte order, so a mapping of the file is a ready matrix
+// (see MappedMatrix).
+struct MatrixFileHeader {
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t ORDER_MARK = 0x01020304;
+    static constexpr uint32_t SWAPPED_ORDER_MARK = 0x04030201;
+
+    char magic[8] = {'M', 'A', 'T', 'R', 'I', 'X', 'B', 'N'};
+    uint32_t version = VERSION;
+    uint32_t byte_order = ORDER_MARK;
+    uint32_t element_kind = 0;
+    uint32_t element_size = 0;
+    uint64_t rows = 0;
+    uint64_t cols = 0;
+    uint64_t data_offset = 0;
+    unsigned char reserved[16] = {};
+};
+
+// Rows moved per read or write call are bounded by this many bytes.
+constexpr size_t MATRIX_IO_BLOCK_BYTES = size_t(1) << 20;
+
+inline void reverse_element_bytes(char* data, size_t count, size_t element_size) {
+    for (size_t i = 0; i < count; ++i, data += element_size) {
+        std::reverse(data, data + element_size);
+    }
+}
+
+// Writes a binary Matrix file a block of rows at a time, so a matrix never
+// has to be in memory whole to be saved. The header goes out first; the
+// caller then supplies exactly rows() rows in order.
+template <typename T>
+class MatrixWriter {
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "binary Matrix files need trivially copyable elements");
+
+    std::unique_ptr<std::ofstream> file;
+    std::ostream* out;
+    size_t rows;
+    size_t cols;
+    size_t written = 0;
+
+    void start() {
+        MatrixFileHeader header;
+        header.element_kind = static_cast<uint32_t>(matrix_element_kind<T>());
+        header.element_size = sizeof(T);
+        header.rows = rows;
+        header.cols = cols;
+        header.data_offset = sizeof(header);
+        out->write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+public:
+    MatrixWriter(std::ostream& out, size_t rows, size_t cols) : out(&out), rows(rows), cols(cols) {
+        start();
+    }
+    MatrixWriter(const std::string& path, size_t rows, size_t cols)
+        : file(new std::ofstream(path, std::ios::binary | std::ios::trunc)), out(file.get()), rows(rows), cols(cols) {
+        if (!*file) {
+            throw std::runtime_error("cannot create Matrix file " + path);
+        }
+        start();
+    }
+    size_t Rows() const noexcept {
+        return rows;
+    }
+    size_t Cols() const noexcept {
+        return cols;
+    }
+    size_t rows_written() const noexcept {
+        return written;
+    }
+    // Appends count rows stored contiguously at data.
+    void write_rows(const T* data, size_t count) {
+        assert(written + count <= rows);
+        out->write(reinterpret_cast<const char*>(data), count * cols * sizeof(T));
+        written += count;
+        if (!*out) {
+            throw std::runtime_error("cannot write Matrix file");
+        }
+    }
+    void write_rows(MatrixView<const T> block) {
+        assert(block.Cols() == cols);
+        if (block.Stride() == cols) {
+            write_rows(block.data(), block.Rows());
+            return;
+        }
+        for (size_t i = 0; i < block.Rows(); ++i) {
+            write_rows(block[i], 1);
+        }
+    }
+    // Flushes and checks that every row was supplied.
+    void close() {
+        if (written != rows) {
+            throw std::logic_error("Matrix file closed before all rows were written");
+        }
+        out->flush();
+        if (!*out) {
+            throw std::runtime_error("cannot write Matrix file");
+        }
+        if (file) {
+            file->close();
+        }
+    }
+};
+
+// Reads a binary Matrix file a block of rows at a time. Files written on a
+// machine of the other byte order are converted as they are read.
+template <typename T>
+class MatrixReader {
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "binary Matrix files need trivially copyable elements");
+
+    std::unique_ptr<std::ifstream> file;
+    std::istream* in;
+    size_t rows = 0;
+    size_t cols = 0;
+    size_t read = 0;
+    bool swap_bytes = false;
+
+    void start() {
+        MatrixFileHeader header;
+        MatrixFileHeader expected;
+        if (!in->read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            throw std::runtime_error("truncated Matrix file");
+        }
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+            throw std::runtime_error("not a Matrix file");
+        }
+        swap_bytes = header.byte_order == MatrixFileHeader::SWAPPED_ORDER_MARK;
+        if (swap_bytes) {
+            reverse_element_bytes(reinterpret_cast<char*>(&header.version), 4, sizeof(uint32_t));
+            reverse_element_bytes(reinterpret_cast<char*>(&header.rows), 3, sizeof(uint64_t));
+        } else if (header.byte_order != MatrixFileHeader::ORDER_MARK) {
+            throw std::runtime_error("corrupt Matrix file");
+        }
+        if (header.version != expected.version) {
+            throw std::runtime_error("unsupported Matrix file version");
+        }
+        if (header.element_kind != static_cast<uint32_t>(matrix_element_kind<T>()) ||
+            header.element_size != sizeof(T)) {
+            throw std::runtime_error("Matrix file element type does not match");
+        }
+        if (swap_bytes && matrix_element_kind<T>() == MatrixElementKind::OPAQUE) {
+            throw std::runtime_error("Matrix file byte order does not match");
+        }
+        if (header.data_offset < sizeof(header)) {
+            throw std::runtime_error("corrupt Matrix file");
+        }
+        in->ignore(header.data_offset - sizeof(header));
+        rows = header.rows;
+        cols = header.cols;
+    }
+
+public:
+    explicit MatrixReader(std::istream& in) : in(&in) {
+        start();
+    }
+    explicit MatrixReader(const std::string& path)
+        : file(new std::ifstream(path, std::ios::binary)), in(file.get()) {
+        if (!*file) {
+            throw std::runtime_error("cannot open Matrix file " + path);
+        }
+        start();
+    }
+    size_t Rows() const noexcept {
+        return rows;
+    }
+    size_t Cols() const noexcept {
+        return cols;
+    }
+    size_t rows_left() const noexcept {
+        return rows - read;
+    }
+    // Reads up to max_rows rows into out (contiguous, row-major) and
+    // returns how many were read; 0 once the matrix is exhausted.
+    size_t read_rows(T* out, size_t max_rows) {
+        size_t count = std::min(max_rows, rows - read);
+        size_t bytes = count * cols * sizeof(T);
+        if (!in->read(reinterpret_cast<char*>(out), bytes)) {
+            throw std::runtime_error("truncated Matrix file");
+        }
+        if (swap_bytes) {
+            reverse_element_bytes(reinterpret_cast<char*>(out), count * cols, sizeof(T));
+        }
+        read += count;
+        return count;
+    }
+    // Rows per block so that one block is about MATRIX_IO_BLOCK_BYTES.
+    size_t block_rows() const noexcept {
+        return std::max<size_t>(1, MATRIX_IO_BLOCK_BYTES / std::max<size_t>(1, cols * sizeof(T)));
+    }
+};
+
+// Dimension value marking a Matrix whose shape is chosen at run time.
+constexpr size_t DYNAMIC = static_cast<size_t>(-1);
+
+// Matrix<T> is the heap-backed, run-time sized matrix; Matrix<T, R, C> with
+// both dimensions fixed is the inline, constexpr one defined further down.
+template <typename T, size_t R = DYNAMIC, size_t C = DYNAMIC>
+class Matrix;
+
+// Base of every lazy matrix expression (CRTP). Arithmetic on Matrix builds a
+// tree of these nodes instead of temporaries; the tree is evaluated in one
+// pass when it is assigned to a Matrix. Leaves are held by reference, so an
+// expression must not outlive its operands: store it in a Matrix, or call
+// eval(), rather than keeping it in an auto variable.
+template <typename E>
+class MatrixExpr {
+public:
+    const E& self() const {
+        return static_cast<const E&>(*this);
+    }
+    template <typename Self = E>
+    Matrix<typename Self::value_type> eval() const {
+        return Matrix<typename Self::value_type>(self());
+    }
+};
+
+// Nested nodes are stored by value (they are cheap), Matrix leaves by reference.
+template <typename E>
+struct MatrixExprStorage {
+    using type = const E;
+};
+
+template <typename T>
+struct MatrixExprStorage<Matrix<T>> {
+    using type = const Matrix<T>&;
+};
+
+// Every node exposes Rows(), Cols(), coeff(i) for row-major flat index i,
+// prepare(), which evaluates any product inside it before the elementwise
+// pass, and depends_on(m), which tells whether it reads matrix m.
+template <typename L, typename R, typename Op>
+class MatrixBinaryExpr : public MatrixExpr<MatrixBinaryExpr<L, R, Op>> {
+private:
+    typename MatrixExprStorage<L>::type _lhs;
+    typename MatrixExprStorage<R>::type _rhs;
+
+public:
+    using value_type = typename L::value_type;
+
+    MatrixBinaryExpr(const L& lhs, const R& rhs) : _lhs(lhs), _rhs(rhs) {
+        assert(lhs.Rows() == rhs.Rows() && lhs.Cols() == rhs.Cols());
+    }
+    size_t Rows() const {
+        return _lhs.Rows();
+    }
+    size_t Cols() const {
+        return _lhs.Cols();
+    }
+    value_type coeff(size_t i) const {
+        return Op()(_lhs.coeff(i), _rhs.coeff(i));
+    }
+    void prepare() const {
+        _lhs.prepare();
+        _rhs.prepare();
+    }
+    bool depends_on(const Matrix<value_type>& m) const {
+        return _lhs.depends_on(m) || _rhs.depends_on(m);
+    }
+};
+
+template <typename E>
+class MatrixScaleExpr : public MatrixExpr<MatrixScaleExpr<E>> {
+public:
+    using value_type = typename E::value_type;
+
+private:
+    typename MatrixExprStorage<E>::type _expr;
+    value_type _scalar;
+
+public:
+    MatrixScaleExpr(const E& expr, const value_type& scalar) : _expr(expr), _scalar(scalar) {
+    }
+    size_t Rows() const {
+        return _expr.Rows();
+    }
+    size_t Cols() const {
+        return _expr.Cols();
+    }
+    value_type coeff(size_t i) const {
+        return _expr.coeff(i) * _scalar;
+    }
+    void prepare() const {
+        _expr.prepare();
+    }
+    bool depends_on(const Matrix<value_type>& m) const {
+        return _expr.depends_on(m);
+    }
+};
+
+// A product is not elementwise: assigned to a Matrix it runs gemm straight
+// into the destination; as an operand of an elementwise node, prepare()
+// materializes it once into an internal buffer.
+template <typename L, typename R>
+class MatrixProductExpr : public MatrixExpr<MatrixProductExpr<L, R>> {
+public:
+    using value_type = typename L::value_type;
+
+private:
+    typename MatrixExprStorage<L>::type _lhs;
+    typename MatrixExprStorage<R>::type _rhs;
+    mutable std::vector<value_type> _value;
+
+    template <typename E>
+    static const Matrix<value_type>& operand(const E& e, Matrix<value_type>& temp) {
+        if constexpr (std::is_same<E, Matrix<value_type>>::value) {
+            return e;
+        } else {
+            temp = e;
+            return temp;
+        }
+    }
+
+public:
+    MatrixProductExpr(const L& lhs, const R& rhs) : _lhs(lhs), _rhs(rhs) {
+        assert(lhs.Cols() == rhs.Rows());
+    }
+    size_t Rows() const {
+        return _lhs.Rows();
+    }
+    size_t Cols() const {
+        return _rhs.Cols();
+    }
+    // dst += lhs * rhs, dst being Rows() x Cols() and row-major; with
+    // accumulate false dst is overwritten instead.
+    void multiply_into(value_type* dst, bool accumulate = true) const {
+        Matrix<value_type> lhs_temp, rhs_temp;
+        const Matrix<value_type>& a = operand(_lhs, lhs_temp);
+        const Matrix<value_type>& b = operand(_rhs, rhs_temp);
+        gemm(a.Rows(), b.Cols(), a.Cols(), a.data(), a.Cols(), b.data(), b.Cols(), dst, b.Cols(), accumulate);
+    }
+    value_type coeff(size_t i) const {
+        return _value[i];
+    }
+    void prepare() const {
+        if (_value.empty()) {
+            _value.resize(Rows() * Cols());
+            multiply_into(_value.data(), false);
+        }
+    }
+    bool depends_on(const Matrix<value_type>& m) const {
+        return _lhs.depends_on(m) || _rhs.depends_on(m);
+    }
+};
+
+template <typename E>
+struct IsMatrixProduct : std::false_type {
+};
+
+template <typename L, typename R>
+struct IsMatrixProduct<MatrixProductExpr<L, R>> : std::true_type {
+};
+
+template <typename T>
+class Matrix<T, DYNAMIC, DYNAMIC> : public MatrixExpr<Matrix<T>> {
+private:
+    // Row-major, one allocation: element (i, j) is mat[i * cols + j].
+    std::vector<T> mat;
+    size_t rows = 0;
+    size_t cols = 0;
+
+    // Elementwise loops split into ranges of this many elements per task.
+    static constexpr size_t PARALLEL_GRAIN = size_t(1) << 16;
+
+    template <typename F>
+    static void for_each_range(size_t n, F f) {
+        ThreadPool::global().parallel_for(n, PARALLEL_GRAIN, f);
+    }
+
+    template <typename Op>
+    Matrix& zip_with(const Matrix& rhs, Op op) {
+        assert(size() == rhs.size());
+        T* out = mat.data();
+        const T* in = rhs.mat.data();
+        for_each_range(mat.size(), [out, in, op](size_t begin, size_t end) {
+            simd_zip(out + begin, in + begin, end - begin, op);
+        });
         return *this;
     }
-    Matrix operator+(const Matrix& rhs) const {
-        Matrix result = mat;
-        result += rhs;
-        return result;
+
+    // Sums partial(begin, end) over fixed PARALLEL_GRAIN chunks in index
+    // order, so the result does not depend on the thread count.
+    template <typename F>
+    T reduce(F partial) const {
+        std::vector<T> partials((mat.size() + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN);
+        for_each_range(mat.size(), [&partials, &partial](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b += PARALLEL_GRAIN) {
+                partials[b / PARALLEL_GRAIN] = partial(b, std::min(end, b + PARALLEL_GRAIN));
+            }
+        });
+        T total = T();
+        for (const T& p : partials) {
+            total += p;
+        }
+        return total;
     }
-    Matrix operator*(const Matrix& other) const {
-        assert(Cols() == other.Rows());
-        Matrix<T> temp = mat;
-        temp *= other;
-        return temp;
+
+    void reshape(size_t new_rows, size_t new_cols) {
+        mat.resize(new_rows * new_cols);
+        rows = new_rows;
+        cols = new_cols;
     }
-    Matrix& operator*=(const Matrix& other) {
-        assert(Cols() == other.Rows());
-        Matrix<T> temp = mat;
-        size_t maxCol = std::max(Cols(), other.Cols());
-        for (auto& v : mat) {
-            v.resize(maxCol);
-        }
-        T sum_elems;
-        for (size_t i = 0; i < Rows(); ++i) {
-            for (size_t j = 0; j < other.Cols(); ++j) {
-                sum_elems = 0;
-                for (size_t k = 0; k < other.Rows(); ++k) {
-                    sum_elems += temp[i][k] * other[k][j];
-                }
-                mat[i][j] = sum_elems;
+
+    template <typename E>
+    void assign(const E& expr) {
+        if constexpr (IsMatrixProduct<E>::value) {
+            if (expr.depends_on(*this)) {
+                Matrix result(expr.Rows(), expr.Cols());
+                expr.multiply_into(result.data(), false);
+                *this = std::move(result);
+                return;
             }
+            reshape(expr.Rows(), expr.Cols());
+            expr.multiply_into(mat.data(), false);
+        } else {
+            expr.prepare();
+            reshape(expr.Rows(), expr.Cols());
+            T* out = mat.data();
+            for_each_range(mat.size(), [out, &expr](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    out[i] = expr.coeff(i);
+                }
+            });
         }
-        mat.resize(Rows());
-        for (auto& v : mat) {
-            v.resize(other.Cols());
+    }
+
+public:
+    using value_type = T;
+
+    Matrix() = default;
+    Matrix(size_t rows, size_t cols, const T& value = T())
+        : mat(rows * cols, value), rows(rows), cols(cols) {
+    }
+    Matrix(const std::vector<std::vector<T>>& matrix)
+        : rows(matrix.size()), cols(matrix.empty() ? 0 : matrix[0].size()) {
+        mat.reserve(rows * cols);
+        for (auto& v : matrix) {
+            assert(v.size() == cols);
+            mat.insert(mat.end(), v.begin(), v.end());
         }
+    }
+    template <typename E>
+    Matrix(const MatrixExpr<E>& expr) {
+        assign(expr.self());
+    }
+    Matrix(const Matrix&) = default;
+    Matrix(Matrix&&) = default;
+    Matrix& operator=(const Matrix&) = default;
+    Matrix& operator=(Matrix&&) = default;
+    template <typename E>
+    Matrix& operator=(const MatrixExpr<E>& expr) {
+        assign(expr.self());
         return *this;
     }
-    Matrix& operator*=(const T& scalar) {
+    template <size_t R, size_t C, typename = std::enable_if_t<R != DYNAMIC && C != DYNAMIC>>
+    Matrix(const Matrix<T, R, C>& fixed)
+        : mat(fixed.begin(), fixed.end()), rows(R), cols(C) {
+    }
+    explicit Matrix(MatrixView<const T> view)
+        : mat(view.Rows() * view.Cols()), rows(view.Rows()), cols(view.Cols()) {
         for (size_t i = 0; i < rows; ++i) {
-            for (size_t j = 0; j < cols; ++j) {
-                mat[i][j] *= scalar;
+            std::copy(view[i], view[i] + cols, mat.data() + i * cols);
+        }
+    }
+    size_t Rows() const noexcept {
+        return rows;
+    }
+    size_t Cols() const noexcept {
+        return cols;
+    }
+    // Row i as a pointer into the buffer, so m[i][j] reads in place.
+    const T* operator[] (size_t i) const {
+        return mat.data() + i * cols;
+    }
+    T* operator[] (size_t i) {
+        return mat.data() + i * cols;
+    }
+    const T& operator()(size_t i, size_t j) const {
+        return mat[i * cols + j];
+    }
+    T& operator()(size_t i, size_t j) {
+        return mat[i * cols + j];
+    }
+    std::pair<size_t, size_t> size() const {
+        return std::make_pair(rows, cols);
+    }
+    T* data() noexcept {
+        return mat.data();
+    }
+    const T* data() const noexcept {
+        return mat.data();
+    }
+    MatrixView<T> view() {
+        return MatrixView<T>(mat.data(), rows, cols, cols);
+    }
+    MatrixView<const T> view() const {
+        return MatrixView<const T>(mat.data(), rows, cols, cols);
+    }
+    MatrixView<T> row(size_t i) {
+        return view().row(i);
+    }
+    MatrixView<const T> row(size_t i) const {
+        return view().row(i);
+    }
+    MatrixView<T> col(size_t j) {
+        return view().col(j);
+    }
+    MatrixView<const T> col(size_t j) const {
+        return view().col(j);
+    }
+    MatrixView<T> submatrix(size_t row, size_t col, size_t rows, size_t cols) {
+        return view().submatrix(row, col, rows, cols);
+    }
+    MatrixView<const T> submatrix(size_t row, size_t col, size_t rows, size_t cols) const {
+        return view().submatrix(row, col, rows, cols);
+    }
+    // Leaf interface of MatrixExpr.
+    const T& coeff(size_t i) const {
+        return mat[i];
+    }
+    void prepare() const {
+    }
+    bool depends_on(const Matrix& m) const {
+        return this == &m;
+    }
+    template <typename E>
+    Matrix& operator+=(const MatrixExpr<E>& rhs) {
+        const E& expr = rhs.self();
+        assert(Rows() == expr.Rows() && Cols() == expr.Cols());
+        if constexpr (std::is_same<E, Matrix>::value) {
+            return zip_with(expr, SimdAdd());
+        }
+        if constexpr (IsMatrixProduct<E>::value) {
+            if (!expr.depends_on(*this)) {
+                expr.multiply_into(mat.data());
+                return *this;
             }
         }
+        expr.prepare();
+        T* out = mat.data();
+        for_each_range(mat.size(), [out, &expr](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                out[i] += expr.coeff(i);
+            }
+        });
         return *this;
     }
-    Matrix operator*(const T& scalar) const {
-        Matrix temp = mat;
-        temp *= scalar;
-        return temp;
+    template <typename E>
+    Matrix& operator-=(const MatrixExpr<E>& rhs) {
+        const E& expr = rhs.self();
+        assert(Rows() == expr.Rows() && Cols() == expr.Cols());
+        if constexpr (std::is_same<E, Matrix>::value) {
+            return zip_with(expr, SimdSub());
+        }
+        expr.prepare();
+        T* out = mat.data();
+        for_each_range(mat.size(), [out, &expr](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                out[i] -= expr.coeff(i);
+            }
+        });
+        return *this;
     }
-    Matrix transposed() const {
-        std::vector<std::vector<T>> temp(Cols(), std::vector<T>(Rows(), 0));
-        Matrix newMat = temp;
-        for (size_t i = 0; i < Rows(); ++i) {
-            for (size_t j = 0; j < Cols(); ++j) {
-                temp[j][i] = mat[i][j];
+    template <typename E>
+    Matrix& operator*=(const MatrixExpr<E>& other) {
+        *this = *this * other.self();
+        return *this;
+    }
+    Matrix& operator*=(const T& scalar) {
+        T* out = mat.data();
+        SimdScale<T> op{scalar};
+        for_each_range(mat.size(), [out, op](size_t begin, size_t end) {
+            simd_map(out + begin, end - begin, op);
+        });
+        return *this;
+    }
+    // GEMV: y = A x, one dot product per row, rows split across threads.
+    std::vector<T> operator*(const std::vector<T>& x) const {
+        assert(x.size() == cols);
+        std::vector<T> y(rows);
+        const T* in = mat.data();
+        size_t n = cols;
+        ThreadPool::global().parallel_for(rows, std::max<size_t>(1, PARALLEL_GRAIN / std::max<size_t>(1, n)),
+                                          [in, n, &x, &y](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                y[i] = simd_dot(in + i * n, x.data(), n);
+            }
+        });
+        return y;
+    }
+    // y = A^T x without forming A^T: y accumulates x[i] * (row i), so A is
+    // still read row by row. Threads own disjoint column ranges of y.
+    std::vector<T> multiply_transposed(const std::vector<T>& x) const {
+        assert(x.size() == rows);
+        std::vector<T> y(cols);
+        const T* in = mat.data();
+        size_t n = cols;
+        size_t m = rows;
+        ThreadPool::global().parallel_for(cols, std::max<size_t>(256, PARALLEL_GRAIN / std::max<size_t>(1, m)),
+                                          [in, n, m, &x, &y](size_t begin, size_t end) {
+            for (size_t i = 0; i < m; ++i) {
+                simd_zip(y.data() + begin, in + i * n + begin, end - begin, SimdAxpy<T>{x[i]});
             }
+        });
+        return y;
+    }
+    // Elementwise (Hadamard) product, in place.
+    Matrix& hadamard(const Matrix& rhs) {
+        return zip_with(rhs, SimdMul());
+    }
+    // this += alpha * x
+    Matrix& axpy(const T& alpha, const Matrix& x) {
+        return zip_with(x, SimdAxpy<T>{alpha});
+    }
+    // Elementwise minimum / maximum with rhs, in place.
+    Matrix& minimum(const Matrix& rhs) {
+        return zip_with(rhs, SimdMin());
+    }
+    Matrix& maximum(const Matrix& rhs) {
+        return zip_with(rhs, SimdMax());
+    }
+    T sum() const {
+        const T* in = mat.data();
+        return reduce([in](size_t begin, size_t end) {
+            return simd_dot<T>(in + begin, nullptr, end - begin);
+        });
+    }
+    T squared_norm() const {
+        const T* in = mat.data();
+        return reduce([in](size_t begin, size_t end) {
+            return simd_dot(in + begin, in + begin, end - begin);
+        });
+    }
+    // Frobenius norm.
+    auto norm() const {
+        using std::sqrt;
+        return sqrt(squared_norm());
+    }
+    // Binary form: a MatrixFileHeader, then the elements row-major. Much
+    // smaller and faster than operator<<, and readable back with load().
+    void save(std::ostream& out) const {
+        MatrixWriter<T> writer(out, rows, cols);
+        writer.write_rows(mat.data(), rows);
+        writer.close();
+    }
+    void save(const std::string& path) const {
+        MatrixWriter<T> writer(path, rows, cols);
+        writer.write_rows(mat.data(), rows);
+        writer.close();
+    }
+    static Matrix load(MatrixReader<T>& reader) {
+        Matrix result(reader.Rows(), reader.Cols());
+        size_t done = 0;
+        while (done < result.rows) {
+            done += reader.read_rows(result[done], std::min(reader.block_rows(), result.rows - done));
         }
+        return result;
+    }
+    static Matrix load(std::istream& in) {
+        MatrixReader<T> reader(in);
+        return load(reader);
+    }
+    static Matrix load(const std::string& path) {
+        MatrixReader<T> reader(path);
+        return load(reader);
+    }
+    Matrix transposed() const {
+        Matrix temp(Cols(), Rows());
+        const T* in = data();
+        T* out = temp.data();
+        size_t r = rows, c = cols;
+        // Each task transposes a band of rows, cache-obliviously.
+        size_t band = TRANSPOSE_LEAF;
+        ThreadPool::global().parallel_for((r + band - 1) / band, std::max<size_t>(1, PARALLEL_GRAIN / (band * c + 1)),
+                                          [=](size_t begin, size_t end) {
+            size_t first = begin * band;
+            transpose_into(in + first * c, c, out + first, r, std::min(r, end * band) - first, c);
+        });
         return temp;
     }
+    // Square matrices are transposed in place band by band: band b handles
+    // its diagonal block and swaps the blocks right of it with the ones
+    // below it, which no other band touches. Other shapes follow cycles.
     Matrix& transpose() {
-        size_t n = std::max(Rows(), Cols());
-        size_t r = Rows();
-        size_t c = Cols();
-        mat.resize(n);
-        for (size_t i = 0; i < n; ++i) {
-            mat[i].resize(n);
+        if (rows != cols) {
+            transpose_cycles(mat.data(), rows, cols);
+            std::swap(rows, cols);
+            return *this;
         }
-        for (size_t i = 0; i < n; i++) {
-            for (size_t j = i + 1; j < n; j++) {
-                std::swap(mat[i][j], mat[j][i]);
+        T* a = mat.data();
+        size_t n = rows;
+        size_t band = TRANSPOSE_LEAF;
+        ThreadPool::global().parallel_for((n + band - 1) / band, std::max<size_t>(1, PARALLEL_GRAIN / (band * n + 1)),
+                                          [=](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b) {
+                size_t first = b * band;
+                size_t last = std::min(n, first + band);
+                transpose_square(a + first * n + first, n, last - first);
+                transpose_swap(a + first * n + last, a + last * n + first, n, last - first, n - last);
             }
-        }
-        mat.resize(c);
-        for (size_t k = 0; k < mat.size(); k++) {
-            mat[k].resize(r);
-        }
+        });
         return *this;
     }
     typename std::vector<T>::iterator begin() {
-        return vecmat.begin();
+        return mat.begin();
     }
     typename std::vector<T>::iterator end() {
-        return vecmat.end();
+        return mat.end();
     }
-    const typename std::vector<T>::const_iterator begin() const {
-        return vecmat.begin();
+    typename std::vector<T>::const_iterator begin() const {
+        return mat.begin();
     }
-    const typename std::vector<T>::const_iterator end() const {
-        return vecmat.end();
+    typename std::vector<T>::const_iterator end() const {
+        return mat.end();
     }
 };
-template<typename T>
-std::ostream& operator<<(std::ostream& out, const Matrix<T>& m) {
+
+// Fixed-size matrix: dimensions are template arguments, storage is an
+// inline array, and every operation is constexpr. Products are checked at
+// compile time (a Matrix<T, R, K> only multiplies a Matrix<T, K, C>) and
+// their dot products are unrolled over K, which suits the 2x2-4x4 transforms
+// of geometry code. Converts to and from the dynamic Matrix<T>.
+template <typename T, size_t R, size_t C>
+class Matrix {
+    static_assert(R != DYNAMIC && C != DYNAMIC, "a Matrix is either fully fixed-size or fully dynamic");
+    static_assert(R > 0 && C > 0, "fixed-size Matrix dimensions must be positive");
+
+private:
+    std::array<T, R * C> mat;
+
+    template <size_t K, size_t... P>
+    static constexpr T dot(const Matrix<T, R, K>& lhs, const Matrix<T, K, C>& rhs, size_t i, size_t j,
+                           std::index_sequence<P...>) {
+        return ((lhs(i, P) * rhs(P, j)) + ...);
+    }
+
+public:
+    using value_type = T;
+    static constexpr size_t ROWS = R;
+    static constexpr size_t COLS = C;
+
+    constexpr Matrix() : mat{} {
+    }
+    constexpr Matrix(const T (&values)[R][C]) : mat{} {
+        for (size_t i = 0; i < R; ++i) {
+            for (size_t j = 0; j < C; ++j) {
+                mat[i * C + j] = values[i][j];
+            }
+        }
+    }
+    explicit Matrix(const Matrix<T>& other) : mat{} {
+        assert(other.Rows() == R && other.Cols() == C);
+        std::copy(other.begin(), other.end(), mat.begin());
+    }
+    operator Matrix<T>() const {
+        Matrix<T> result(R, C);
+        std::copy(mat.begin(), mat.end(), result.begin());
+        return result;
+    }
+    static constexpr Matrix identity() {
+        static_assert(R == C, "identity() needs a square matrix");
+        Matrix result;
+        for (size_t i = 0; i < R; ++i) {
+            result(i, i) = T(1);
+        }
+        return result;
+    }
+    constexpr size_t Rows() const noexcept {
+        return R;
+    }
+    constexpr size_t Cols() const noexcept {
+        return C;
+    }
+    constexpr std::pair<size_t, size_t> size() const {
+        return std::make_pair(R, C);
+    }
+    constexpr const T* operator[] (size_t i) const {
+        return mat.data() + i * C;
+    }
+    constexpr T* operator[] (size_t i) {
+        return mat.data() + i * C;
+    }
+    constexpr const T& operator()(size_t i, size_t j) const {
+        return mat[i * C + j];
+    }
+    constexpr T& operator()(size_t i, size_t j) {
+        return mat[i * C + j];
+    }
+    constexpr T* data() noexcept {
+        return mat.data();
+    }
+    constexpr const T* data() const noexcept {
+        return mat.data();
+    }
+    MatrixView<T> view() {
+        return MatrixView<T>(mat.data(), R, C, C);
+    }
+    MatrixView<const T> view() const {
+        return MatrixView<const T>(mat.data(), R, C, C);
+    }
+    constexpr Matrix& operator+=(const Matrix& rhs) {
+        for (size_t i = 0; i < R * C; ++i) {
+            mat[i] += rhs.mat[i];
+        }
+        return *this;
+    }
+    constexpr Matrix operator+(const Matrix& rhs) const {
+        Matrix result = *this;
+        result += rhs;
+        return result;
+    }
+    constexpr Matrix& operator*=(const T& scalar) {
+        for (auto& el : mat) {
+            el *= scalar;
+        }
+        return *this;
+    }
+    constexpr Matrix operator*(const T& scalar) const {
+        Matrix result = *this;
+        result *= scalar;
+        return result;
+    }
+    template <size_t N>
+    constexpr Matrix<T, R, N> operator*(const Matrix<T, C, N>& rhs) const {
+        Matrix<T, R, N> result;
+        for (size_t i = 0; i < R; ++i) {
+            for (size_t j = 0; j < N; ++j) {
+                result(i, j) = Matrix<T, R, N>::dot(*this, rhs, i, j, std::make_index_sequence<C>());
+            }
+        }
+        return result;
+    }
+    constexpr Matrix& operator*=(const Matrix<T, C, C>& rhs) {
+        *this = *this * rhs;
+        return *this;
+    }
+    constexpr std::array<T, R> operator*(const std::array<T, C>& x) const {
+        std::array<T, R> y{};
+        for (size_t i = 0; i < R; ++i) {
+            for (size_t j = 0; j < C; ++j) {
+                y[i] += mat[i * C + j] * x[j];
+            }
+        }
+        return y;
+    }
+    constexpr bool operator==(const Matrix& rhs) const {
+        for (size_t i = 0; i < R * C; ++i) {
+            if (!(mat[i] == rhs.mat[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    constexpr bool operator!=(const Matrix& rhs) const {
+        return !(*this == rhs);
+    }
+    constexpr Matrix<T, C, R> transposed() const {
+        Matrix<T, C, R> result;
+        for (size_t i = 0; i < R; ++i) {
+            for (size_t j = 0; j < C; ++j) {
+                result(j, i) = (*this)(i, j);
+            }
+        }
+        return result;
+    }
+    constexpr Matrix& transpose() {
+        static_assert(R == C, "in-place transpose of a fixed-size matrix needs a square shape");
+        *this = transposed();
+        return *this;
+    }
+    constexpr typename std::array<T, R * C>::iterator begin() {
+        return mat.begin();
+    }
+    constexpr typename std::array<T, R * C>::iterator end() {
+        return mat.end();
+    }
+    constexpr typename std::array<T, R * C>::const_iterator begin() const {
+        return mat.begin();
+    }
+    constexpr typename std::array<T, R * C>::const_iterator end() const {
+        return mat.end();
+    }
+
+    template <typename U, size_t R2, size_t C2>
+    friend class Matrix;
+};
+
+template <typename L, typename R>
+MatrixBinaryExpr<L, R, std::plus<>> operator+(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs) {
+    return MatrixBinaryExpr<L, R, std::plus<>>(lhs.self(), rhs.self());
+}
+
+template <typename L, typename R>
+MatrixBinaryExpr<L, R, std::minus<>> operator-(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs) {
+    return MatrixBinaryExpr<L, R, std::minus<>>(lhs.self(), rhs.self());
+}
+
+template <typename L, typename R>
+MatrixProductExpr<L, R> operator*(const MatrixExpr<L>& lhs, const MatrixExpr<R>& rhs) {
+    return MatrixProductExpr<L, R>(lhs.self(), rhs.self());
+}
+
+template <typename E>
+MatrixScaleExpr<E> operator*(const MatrixExpr<E>& expr, const typename E::value_type& scalar) {
+    return MatrixScaleExpr<E>(expr.self(), scalar);
+}
+
+template <typename E>
+MatrixScaleExpr<E> operator*(const typename E::value_type& scalar, const MatrixExpr<E>& expr) {
+    return MatrixScaleExpr<E>(expr.self(), scalar);
+}
+
+// Row vector times matrix: x^T A, which is A^T x.
+template <typename T>
+std::vector<T> operator*(const std::vector<T>& x, const Matrix<T>& a) {
+    return a.multiply_transposed(x);
+}
+
+// Batches whose products are at most this many multiply-adds each are
+// computed interleaved; bigger ones are worth a gemm call apiece.
+constexpr size_t BATCH_INTERLEAVE_FLOPS = 16 * 16 * 16;
+// Products computed side by side in one interleaved tile.
+constexpr size_t BATCH_LANES = 64;
+
+// out[b] = a[b] * b[b] for b < count. When every product has the same small
+// shape, a tile of BATCH_LANES products is transposed so that element (i, j)
+// of all of them is contiguous; the multiply-add over the lanes is then a
+// plain vectorizable loop, instead of count tiny gemm calls that never fill
+// a SIMD register. Tiles run in parallel. Mixed or large shapes fall back to
+// one gemm per product. out may be a or b: each product is built aside and
+// only moved into out[i] once a[i] and b[i] have been read.
+template <typename T>
+void batched_multiply(const Matrix<T>* a, const Matrix<T>* b, Matrix<T>* out, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    size_t m = a[0].Rows();
+    size_t k = a[0].Cols();
+    size_t n = b[0].Cols();
+    bool uniform = m * n * k <= BATCH_INTERLEAVE_FLOPS;
+    for (size_t i = 0; i < count && uniform; ++i) {
+        uniform = a[i].Rows() == m && a[i].Cols() == k && b[i].Rows() == k && b[i].Cols() == n;
+    }
+    if (!uniform) {
+        ThreadPool::global().parallel_for(count, 1, [a, b, out](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                assert(a[i].Cols() == b[i].Rows());
+                Matrix<T> product(a[i].Rows(), b[i].Cols());
+                gemm(a[i].Rows(), b[i].Cols(), a[i].Cols(), a[i].data(), a[i].Cols(), b[i].data(), b[i].Cols(),
+                     product.data(), b[i].Cols(), false);
+                out[i] = std::move(product);
+            }
+        });
+        return;
+    }
+    size_t tiles = (count + BATCH_LANES - 1) / BATCH_LANES;
+    ThreadPool::global().parallel_for(tiles, 1, [=](size_t tile_begin, size_t tile_end) {
+        constexpr size_t L = BATCH_LANES;
+        std::vector<T> pa(m * k * L), pb(k * n * L), pc(m * n * L);
+        for (size_t tile = tile_begin; tile < tile_end; ++tile) {
+            size_t first = tile * L;
+            size_t lanes = std::min(L, count - first);
+            std::fill(pc.begin(), pc.end(), T());
+            for (size_t l = 0; l < lanes; ++l) {
+                const T* sa = a[first + l].data();
+                const T* sb = b[first + l].data();
+                for (size_t e = 0; e < m * k; ++e) {
+                    pa[e * L + l] = sa[e];
+                }
+                for (size_t e = 0; e < k * n; ++e) {
+                    pb[e * L + l] = sb[e];
+                }
+            }
+            for (size_t i = 0; i < m; ++i) {
+                for (size_t p = 0; p < k; ++p) {
+                    const T* av = pa.data() + (i * k + p) * L;
+                    for (size_t j = 0; j < n; ++j) {
+                        const T* bv = pb.data() + (p * n + j) * L;
+                        T* cv = pc.data() + (i * n + j) * L;
+                        for (size_t l = 0; l < L; ++l) {
+                            cv[l] += av[l] * bv[l];
+                        }
+                    }
+                }
+            }
+            for (size_t l = 0; l < lanes; ++l) {
+                Matrix<T> product(m, n);
+                T* dc = product.data();
+                for (size_t e = 0; e < m * n; ++e) {
+                    dc[e] = pc[e * L + l];
+                }
+                out[first + l] = std::move(product);
+            }
+        }
+    });
+}
+
+template <typename T>
+std::vector<Matrix<T>> batched_multiply(const std::vector<Matrix<T>>& a, const std::vector<Matrix<T>>& b) {
+    assert(a.size() == b.size());
+    std::vector<Matrix<T>> out(a.size());
+    batched_multiply(a.data(), b.data(), out.data(), a.size());
+    return out;
+}
+
+template<typename T, size_t R, size_t C>
+std::ostream& operator<<(std::ostream& out, const Matrix<T, R, C>& m) {
     for (size_t i = 0; i < m.Rows(); ++i) {
         for (size_t j = 0; j < m.Cols(); ++j) {
             if (j == m.Cols() - 1) {
@@ -155,4 +1812,4 @@ std::ostream& operator<<(std::ostream& out, const Matrix<T>& m) {
         }
     }
     return out;
-}
\ No newline at end of file
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Slab pool with power-of-two size classes. Small blocks are carved out of
+// large chunks; every freed block goes onto its class's free list and is
+// handed back by the next request of that class instead of reaching malloc.
+// Memory returns to the system only when the pool is destroyed.
+// A pool is not thread-safe: give each thread (or each map) its own.
+class MemoryPool {
+public:
+    static constexpr size_t MIN_BLOCK = 16;
+    static constexpr size_t ALIGNMENT = 64;
+
+    explicit MemoryPool(size_t chunk_size = 1 << 20) : _chunk_size(chunk_size) {
+    }
+
+    MemoryPool(const MemoryPool &) = delete;
+
+    MemoryPool &operator=(const MemoryPool &) = delete;
+
+    ~MemoryPool() {
+        for (void *chunk : _chunks) {
+            ::operator delete(chunk, std::align_val_t(ALIGNMENT));
+        }
+    }
+
+    void *allocate(size_t bytes) {
+        size_t cls = size_class(bytes);
+        // The free list is made here, so returning the block never allocates.
+        if (cls >= _free.size()) {
+            _free.resize(cls + 1, nullptr);
+        }
+        if (_free[cls] != nullptr) {
+            FreeBlock *block = _free[cls];
+            _free[cls] = block->next;
+            return block;
+        }
+        size_t block_size = MIN_BLOCK << cls;
+        // Blocks bigger than a slab's worth get a chunk of their own.
+        if (block_size > _chunk_size / 8) {
+            return new_chunk(block_size);
+        }
+        size_t align = std::min(block_size, ALIGNMENT);
+        _offset = (_offset + align - 1) & ~(align - 1);
+        if (_current == nullptr || _offset + block_size > _chunk_size) {
+            _current = static_cast<char *>(new_chunk(_chunk_size));
+            _offset = 0;
+        }
+        void *block = _current + _offset;
+        _offset += block_size;
+        return block;
+    }
+
+    void deallocate(void *p, size_t bytes) noexcept {
+        if (p == nullptr) {
+            return;
+        }
+        size_t cls = size_class(bytes);
+        assert(cls < _free.size());
+        _free[cls] = new(p) FreeBlock{_free[cls]};
+    }
+
+    size_t bytes_reserved() const {
+        return _reserved;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    static size_t size_class(size_t bytes) {
+        size_t cls = 0;
+        while ((MIN_BLOCK << cls) < bytes) {
+            ++cls;
+        }
+        return cls;
+    }
+
+    void *new_chunk(size_t bytes) {
+        void *chunk = ::operator new(bytes, std::align_val_t(ALIGNMENT));
+        _chunks.push_back(chunk);
+        _reserved += bytes;
+        return chunk;
+    }
+
+    size_t _chunk_size;
+    char *_current = nullptr;
+    size_t _offset = 0;
+    size_t _reserved = 0;
+    std::vector<void *> _chunks;
+    std::vector<FreeBlock *> _free;
+};
+
+// Standard allocator interface over a MemoryPool, usable as the Alloc
+// parameter of HashMap or of any node-based standard container.
+template<class T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    explicit PoolAllocator(MemoryPool &pool) noexcept : _pool(&pool) {
+    }
+
+    template<class U>
+    PoolAllocator(const PoolAllocator<U> &other) noexcept : _pool(other._pool) {
+    }
+
+    T *allocate(size_t n) {
+        static_assert(alignof(T) <= MemoryPool::ALIGNMENT, "over-aligned type");
+        return static_cast<T *>(_pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        _pool->deallocate(p, n * sizeof(T));
+    }
+
+    MemoryPool &pool() const noexcept {
+        return *_pool;
+    }
+
+    template<class U>
+    friend bool operator==(const PoolAllocator &lhs, const PoolAllocator<U> &rhs) noexcept {
+        return &lhs.pool() == &rhs.pool();
+    }
+
+    template<class U>
+    friend bool operator!=(const PoolAllocator &lhs, const PoolAllocator<U> &rhs) noexcept {
+        return &lhs.pool() != &rhs.pool();
+    }
+
+private:
+    template<class U> friend class PoolAllocator;
+
+    MemoryPool *_pool;
+};
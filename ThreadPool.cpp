@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run one parallel_for at a time. The
+// calling thread works on the loop too, so a pool of size n uses n - 1
+// workers. A pool of size 1 runs every loop inline, in order, on the
+// caller; that is the deterministic mode for tests and debugging.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = default_threads()) {
+        for (size_t i = 1; i < threads; ++i) {
+            _workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (auto &worker : _workers) {
+            worker.join();
+        }
+    }
+
+    // Threads taking part in a loop, the caller included.
+    size_t size() const {
+        return _workers.size() + 1;
+    }
+
+    // Calls f(begin, end) on disjoint ranges covering [0, n), each at most
+    // grain long, and returns when all of them have finished. The first
+    // exception thrown by f is rethrown here. Loops started from inside
+    // another loop, or while another thread owns the pool, run inline.
+    template<class F>
+    void parallel_for(size_t n, size_t grain, F f) {
+        if (n == 0) {
+            return;
+        }
+        grain = std::max<size_t>(grain, 1);
+        size_t chunks = (n + grain - 1) / grain;
+        if (_workers.empty() || chunks == 1 || _inside_loop) {
+            f(0, n);
+            return;
+        }
+        std::unique_lock<std::mutex> owner(_submit, std::try_to_lock);
+        if (!owner.owns_lock()) {
+            f(0, n);
+            return;
+        }
+        Job job;
+        job.body = [](void *context, size_t begin, size_t end) {
+            (*static_cast<F *>(context))(begin, end);
+        };
+        job.context = &f;
+        job.n = n;
+        job.grain = grain;
+        job.chunks = chunks;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job = job;
+            _next = 0;
+            _pending = chunks;
+            _error = nullptr;
+            ++_generation;
+        }
+        _wake.notify_all();
+        _inside_loop = true;
+        run_chunks(job);
+        _inside_loop = false;
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _pending == 0 && _active == 0; });
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+    // Pool shared by the Matrix kernels, sized to the machine by default.
+    static ThreadPool &global() {
+        return *global_slot();
+    }
+
+    // Replaces the shared pool; 1 makes every Matrix operation single-threaded.
+    // Must not be called while another thread is using the shared pool.
+    static void set_global_threads(size_t threads) {
+        global_slot().reset(new ThreadPool(threads));
+    }
+
+    static size_t default_threads() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+private:
+    struct Job {
+        void (*body)(void *, size_t, size_t) = nullptr;
+        void *context = nullptr;
+        size_t n = 0;
+        size_t grain = 0;
+        size_t chunks = 0;
+    };
+
+    static std::unique_ptr<ThreadPool> &global_slot() {
+        static std::unique_ptr<ThreadPool> pool(new ThreadPool());
+        return pool;
+    }
+
+    void run_chunks(const Job &job) {
+        size_t c;
+        while ((c = _next.fetch_add(1)) < job.chunks) {
+            size_t begin = c * job.grain;
+            try {
+                job.body(job.context, begin, std::min(job.n, begin + job.grain));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_error) {
+                    _error = std::current_exception();
+                }
+            }
+            if (_pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _done.notify_all();
+            }
+        }
+    }
+
+    // Workers join a job under the lock, only while it still has chunks
+    // pending, and count themselves active until they leave it. The caller
+    // waits for the active count too, so the next job cannot reset _next
+    // under a worker still running the previous one.
+    void work() {
+        _inside_loop = true;
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _wake.wait(lock, [&] { return _stop || _generation != seen; });
+            if (_stop) {
+                return;
+            }
+            seen = _generation;
+            if (_pending == 0) {
+                continue;
+            }
+            Job job = _job;
+            ++_active;
+            lock.unlock();
+            run_chunks(job);
+            lock.lock();
+            if (--_active == 0 && _pending == 0) {
+                _done.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::mutex _submit;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    Job _job;
+    std::atomic<size_t> _next{0};
+    std::atomic<size_t> _pending{0};
+    size_t _active = 0;
+    size_t _generation = 0;
+    bool _stop = false;
+    std::exception_ptr _error;
+    static inline thread_local bool _inside_loop = false;
+};
@@ -84,7 +84,7 @@ public:
     }
 
     Vector(Vector &&other) noexcept {
-        Swap(other);
+        swap(other);
     }
 
     size_t size() const {
@@ -123,7 +123,7 @@ public:
     }
 
     Vector &operator=(Vector &&other) noexcept {
-        Swap(other);
+        swap(other);
         return *this;
     }
 
@@ -212,6 +212,13 @@ public:
     }
 
 private:
+    template<typename U, size_t N>
+    friend class SmallVector;
+
+    // Takes over memory whose first size slots hold constructed elements.
+    Vector(RawMemory<T> &&memory, size_t size) : _vect(move(memory)), _size(size) {
+    }
+
     static void Construct(void *buf) {
         new(buf) T();
     }
@@ -230,4 +237,209 @@ private:
 
     RawMemory<T> _vect;
     size_t _size = 0;
-};
\ No newline at end of file
+};
+
+// Vector that keeps its first N elements in an inline buffer and only
+// allocates (through RawMemory) once it grows past them, so the short
+// vectors that make up most instances never touch the heap. Same interface
+// as Vector; converting an rvalue to Vector<T> hands over the heap buffer
+// when there is one.
+template<typename T, size_t N>
+class SmallVector {
+public:
+    static_assert(N > 0, "SmallVector needs room for at least one inline element");
+
+    SmallVector() = default;
+
+    SmallVector(size_t n) {
+        reserve(n);
+        uninitialized_value_construct_n(data(), n);
+        _size = n;
+    }
+
+    SmallVector(const SmallVector &other) {
+        reserve(other._size);
+        uninitialized_copy_n(other.data(), other._size, data());
+        _size = other._size;
+    }
+
+    SmallVector(SmallVector &&other) noexcept {
+        take(other);
+    }
+
+    SmallVector &operator=(const SmallVector &other) {
+        if (this != &other) {
+            clear();
+            reserve(other._size);
+            uninitialized_copy_n(other.data(), other._size, data());
+            _size = other._size;
+        }
+        return *this;
+    }
+
+    SmallVector &operator=(SmallVector &&other) noexcept {
+        if (this != &other) {
+            clear();
+            RawMemory<T>().Swap(_heap);
+            take(other);
+        }
+        return *this;
+    }
+
+    ~SmallVector() {
+        destroy_n(data(), _size);
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    size_t capacity() const {
+        return on_heap() ? _heap.capacity_ : N;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    // True while the elements live in the inline buffer.
+    bool is_inline() const {
+        return !on_heap();
+    }
+
+    const T &operator[](size_t i) const {
+        return data()[i];
+    }
+
+    T &operator[](size_t i) {
+        return data()[i];
+    }
+
+    void reserve(size_t n) {
+        if (n > capacity()) {
+            RawMemory<T> data2(n);
+            uninitialized_move_n(data(), _size, data2.buf_);
+            destroy_n(data(), _size);
+            _heap.Swap(data2);
+        }
+    }
+
+    void resize(size_t n) {
+        reserve(n);
+        if (_size < n) {
+            uninitialized_value_construct_n(data() + _size, n - _size);
+        } else if (_size > n) {
+            destroy_n(data() + n, _size - n);
+        }
+        _size = n;
+    }
+
+    void push_back(const T &elem) {
+        EmplaceBack(elem);
+    }
+
+    void push_back(T &&elem) {
+        EmplaceBack(move(elem));
+    }
+
+    void pop_back() {
+        destroy_at(data() + _size - 1);
+        --_size;
+    }
+
+    // On growth the new element is built in the new buffer before the old
+    // ones move, so args may refer to elements of this vector.
+    template<typename ... Args>
+    T &EmplaceBack(Args &&... args) {
+        if (_size < capacity()) {
+            auto elem = new(data() + _size) T(forward<Args>(args)...);
+            ++_size;
+            return *elem;
+        }
+        RawMemory<T> data2(_size * 2);
+        auto elem = new(data2 + _size) T(forward<Args>(args)...);
+        uninitialized_move_n(data(), _size, data2.buf_);
+        destroy_n(data(), _size);
+        _heap.Swap(data2);
+        ++_size;
+        return *elem;
+    }
+
+    T *data() noexcept {
+        return on_heap() ? _heap.buf_ : reinterpret_cast<T *>(_inline);
+    }
+
+    const T *data() const noexcept {
+        return on_heap() ? _heap.buf_ : reinterpret_cast<const T *>(_inline);
+    }
+
+    T *begin() noexcept {
+        return data();
+    }
+
+    const T *begin() const noexcept {
+        return data();
+    }
+
+    T *end() noexcept {
+        return data() + _size;
+    }
+
+    const T *end() const noexcept {
+        return data() + _size;
+    }
+
+    void clear() {
+        destroy_n(data(), _size);
+        _size = 0;
+    }
+
+    operator Vector<T>() const &{
+        Vector<T> result;
+        result.reserve(_size);
+        for (const T &elem : *this) {
+            result.push_back(elem);
+        }
+        return result;
+    }
+
+    // Spilled elements are handed over with their buffer, without copying
+    // or moving any of them; inline ones are moved into one exact-size
+    // allocation. Leaves this vector empty.
+    operator Vector<T>() &&{
+        if (_size == 0) {
+            return Vector<T>();
+        }
+        size_t size = _size;
+        if (on_heap()) {
+            _size = 0;
+            return Vector<T>(move(_heap), size);
+        }
+        RawMemory<T> memory(size);
+        uninitialized_move_n(data(), size, memory.buf_);
+        clear();
+        return Vector<T>(move(memory), size);
+    }
+
+private:
+    bool on_heap() const {
+        return _heap.buf_ != nullptr;
+    }
+
+    // Moves other's contents into this empty, inline vector and leaves
+    // other empty and inline.
+    void take(SmallVector &other) {
+        if (other.on_heap()) {
+            _heap.Swap(other._heap);
+        } else {
+            uninitialized_move_n(other.data(), other._size, data());
+            destroy_n(other.data(), other._size);
+        }
+        _size = other._size;
+        other._size = 0;
+    }
+
+    alignas(T) unsigned char _inline[N * sizeof(T)];
+    RawMemory<T> _heap;
+    size_t _size = 0;
+};
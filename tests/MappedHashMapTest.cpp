@@ -0,0 +1,105 @@
+// g++ -std=c++17 tests/MappedHashMapTest.cpp && ./a.out
+#include "../MappedHashMap.cpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+static const char *PATH = "mapped_hash_map_test.bin";
+
+static std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string &path, const std::string &bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+template<class Field>
+static void patch(std::string &bytes, size_t offset, Field value) {
+    std::memcpy(&bytes[offset], &value, sizeof(value));
+}
+
+static bool rejected(const std::string &bytes) {
+    write_file(PATH, bytes);
+    try {
+        MappedHashMap<int, int> map(PATH);
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    HashMap<int, int> source;
+    for (int i = 0; i < 1000; ++i) {
+        source[i] = i * i;
+    }
+    source.save(PATH);
+    const std::string image = read_file(PATH);
+    HashMapSnapshotHeader header;
+    std::memcpy(&header, image.data(), sizeof(header));
+
+    {
+        MappedHashMap<int, int> map(PATH);
+        assert(map.size() == 1000);
+        assert(map.at(31) == 961);
+        assert(map.find(5000) == map.end());
+    }
+
+    std::string bytes = image;
+    patch(bytes, offsetof(HashMapSnapshotHeader, buckets), header.buckets * 4);
+    assert(rejected(bytes));
+
+    bytes = image;
+    patch(bytes, offsetof(HashMapSnapshotHeader, ctrl_offset), uint64_t(image.size() - 8));
+    assert(rejected(bytes));
+
+    bytes = image;
+    patch(bytes, offsetof(HashMapSnapshotHeader, ctrl_offset), header.ctrl_offset + 1);
+    assert(rejected(bytes));
+
+    bytes = image;
+    patch(bytes, offsetof(HashMapSnapshotHeader, slots_offset), uint64_t(image.size()));
+    assert(rejected(bytes));
+
+    bytes = image;
+    bytes[header.ctrl_offset + header.buckets] = 0;
+    assert(rejected(bytes));
+
+    bytes = image;
+    patch(bytes, offsetof(HashMapSnapshotHeader, buckets), uint64_t(4));
+    bytes[header.ctrl_offset + 4] = static_cast<char>(-1);
+    assert(rejected(bytes));
+
+    bytes = image;
+    std::fill(&bytes[header.ctrl_offset], &bytes[header.ctrl_offset + header.buckets], 0);
+    patch(bytes, offsetof(HashMapSnapshotHeader, size), header.buckets);
+    assert(rejected(bytes));
+
+    bytes = image;
+    patch(bytes, offsetof(HashMapSnapshotHeader, size), header.buckets);
+    assert(rejected(bytes));
+
+    bytes = image;
+    size_t empty = image.find(static_cast<char>(-128), header.ctrl_offset);
+    bytes[empty] = static_cast<char>(-5);
+    assert(rejected(bytes));
+
+    bytes = image;
+    bytes.resize(header.ctrl_offset + 4);
+    assert(rejected(bytes));
+
+    bytes = image;
+    bytes[0] = 'X';
+    assert(rejected(bytes));
+
+    std::remove(PATH);
+    return 0;
+}
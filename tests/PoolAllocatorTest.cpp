@@ -0,0 +1,29 @@
+// g++ -std=c++17 tests/PoolAllocatorTest.cpp && ./a.out
+#include "../PoolAllocator.cpp"
+
+#include <cassert>
+#include <list>
+
+int main() {
+    MemoryPool pool;
+    MemoryPool other_pool;
+    PoolAllocator<int> ints(pool);
+    PoolAllocator<long> longs(ints);
+    PoolAllocator<long> other(other_pool);
+
+    // Rebound copies compare equal to the allocator they came from.
+    assert(ints == longs);
+    assert(longs == ints);
+    assert(!(ints != longs));
+    assert(ints != other);
+    assert(!(ints == other));
+    assert(PoolAllocator<int>(longs) == ints);
+
+    // A container rebinds the allocator to its node type and back.
+    std::list<int, PoolAllocator<int>> values(ints);
+    values.push_back(1);
+    values.push_back(2);
+    assert(values.get_allocator() == longs);
+    assert(values.size() == 2);
+    return 0;
+}